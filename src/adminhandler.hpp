@@ -20,60 +20,313 @@
   along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
 
 */
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 #include <osmium/geom/mercator_projection.hpp>
 
+#include "borderline.hpp"
+#include "extract.hpp"
+#include "idset.hpp"
+#include "linemerge.hpp"
+#include "linesink.hpp"
+#include "linewriter.hpp"
+#include "mvt.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "parallel.hpp"
+#include "simplify.hpp"
+#include "state.hpp"
+#include "stats.hpp"
+#include "tagrules.hpp"
+#include "waylevels.hpp"
+
 class AdminHandler : public osmium::handler::Handler
 {
 private:
     // p1
-    // All relations we are interested in will be kept in this buffer
-    osmium::memory::Buffer m_relations_buffer;
-    // Mapping of way IDs to the offset to the parent relation
-    typedef std::vector<size_t> RelationParents;
-    typedef std::map<osmium::unsigned_object_id_type, RelationParents>
-        WayRelations;
-    WayRelations m_way_rels;
+    // Admin levels of the parent relations of each way
+    WayLevelsTable m_way_levels;
+    // IDs of the ways in m_way_levels, for fast lookups while reading ways
+    IdSet m_way_ids;
 
     // p2
     // All ways we're interested in
     osmium::memory::Buffer m_ways_buffer;
+    // IDs of all nodes referenced by those ways
+    IdSet m_node_ids;
 
-    osmium::geom::WKBFactory<osmium::geom::MercatorProjection> m_factory{
-        osmium::geom::wkb_type::ewkb, osmium::geom::out_type::hex};
     static constexpr size_t initial_buffer_size = 1024 * 1024;
+    // Number of ways handed to a worker thread at a time
+    static constexpr size_t ways_per_chunk = 1024;
+
+    // Where the lines go, the main output first
+    struct output
+    {
+        // Simplify the lines for this output with this tolerance, if not 0
+        double tolerance;
+        std::unique_ptr<LineWriter> writer;
+    };
+    std::vector<output> m_outputs;
+
+    // Join ways into longer lines before writing them?
+    const bool m_merge_lines;
+
+    const TagRules &m_rules;
+
+    // Filled for later updates if set
+    BorderState *m_state = nullptr;
+
+    // Only write the parts of lines in this area if set
+    const ExtractArea *m_area = nullptr;
+    // Clip them exactly to it?
+    bool m_clip = false;
+
+    uint64_t m_relations_seen = 0;
+    uint64_t m_relations_kept = 0;
+    // Lines written to the main output
+    uint64_t m_lines = 0;
+    GeometryErrors m_geometry_errors;
+
+    // The lines of one chunk of ways for the outputs
+    struct line_batches
+    {
+        // As built, shared by the outputs that aren't simplified
+        std::vector<BorderLine> lines;
+        // For each output in m_outputs with a tolerance
+        std::vector<std::vector<BorderLine>> simplified;
+    };
+
+    // What the worker threads produce for one chunk of ways
+    struct chunk_output
+    {
+        line_batches lines;
+        std::string errors;
+        GeometryErrors geometry_errors;
+        // Number of ways turned into lines
+        size_t num_lines = 0;
+        // The lines themselves, if they are merged before writing
+        std::vector<WayLine> way_lines;
+    };
+
+    /// Add a line to the batches, simplifying it where needed.
+    void batch_line(BorderLine &&line, line_batches &out) const
+    {
+        out.simplified.resize(m_outputs.size());
+
+        BorderLine simplified;
+        simplified.id = line.id;
+        simplified.admin_level = line.admin_level;
+        simplified.dividing_line = line.dividing_line;
+        simplified.disputed = line.disputed;
+        simplified.maritime = line.maritime;
+        simplified.way_ids = line.way_ids;
+        for (size_t i = 0; i < m_outputs.size(); ++i) {
+            if (m_outputs[i].tolerance == 0.0) {
+                continue;
+            }
+            simplified.coordinates =
+                simplify_line(line.coordinates, m_outputs[i].tolerance);
+            // Small closed lines collapse into a single point
+            const auto &c = simplified.coordinates;
+            if (c.size() == 2 && c[0].x == c[1].x && c[0].y == c[1].y) {
+                continue;
+            }
+            out.simplified[i].push_back(simplified);
+        }
+        out.lines.push_back(std::move(line));
+    }
+
+    /**
+     * Queue batches from batch_line() for their outputs, in order. The
+     * outputs format and write them on their own threads.
+     */
+    void write_lines(line_batches &&batches)
+    {
+        const auto lines = std::make_shared<const std::vector<BorderLine>>(
+            std::move(batches.lines));
+        for (size_t i = 0; i < m_outputs.size(); ++i) {
+            if (m_outputs[i].tolerance == 0.0) {
+                m_outputs[i].writer->write(lines);
+            } else if (i < batches.simplified.size()) {
+                m_outputs[i].writer->write(
+                    std::make_shared<const std::vector<BorderLine>>(
+                        std::move(batches.simplified[i])));
+            }
+        }
+    }
+
+    /// Hand a finished line to the merging or the outputs.
+    void add_line(BorderLine &&line, osmium::object_id_type first_node,
+                  osmium::object_id_type last_node, chunk_output &out) const
+    {
+        if (m_merge_lines) {
+            out.way_lines.push_back(
+                WayLine{std::move(line), first_node, last_node});
+        } else {
+            batch_line(std::move(line), out.lines);
+        }
+        ++out.num_lines;
+    }
 
-    static const std::map<std::string, const int> admin_levels;
-
-    // Based on osm2pgsql escaping
-    std::string escape(const std::string &src)
-    {
-        std::string dst;
-        for (const char c : src) {
-            switch (c) {
-            case '\\':
-                dst.append("\\\\");
-                break;
-            //case 8:   dst.append("\\\b"); break;
-            //case 12:  dst.append("\\\f"); break;
-            case '\n':
-                dst.append("\\\n");
-                break;
-            case '\r':
-                dst.append("\\\r");
-                break;
-            case '\t':
-                dst.append("\\\t");
-                break;
-            //case 11:  dst.append("\\\v"); break;
-            default:
-                dst.push_back(c);
-                break;
+    /**
+     * write_way() for extracts. Nodes outside the area and its buffer have
+     * no location, so the way is split into runs of nodes with locations.
+     * Runs that don't reach into the area are left out, the others are
+     * written whole or clipped to the area.
+     */
+    void write_way_parts(const osmium::Way &way, BorderLine &line,
+                         chunk_output &out) const
+    {
+        const auto &nodes = way.nodes();
+        const auto kept = [this](const osmium::NodeRef &nr) {
+            return m_area->keep(nr.location());
+        };
+        std::vector<std::vector<osmium::geom::Coordinates>> parts;
+        auto begin = nodes.begin();
+        while (begin != nodes.end()) {
+            begin = std::find_if(begin, nodes.end(), kept);
+            const auto end = std::find_if_not(begin, nodes.end(), kept);
+            if (end - begin < 2) {
+                begin = end;
+                continue;
+            }
+            BorderLine part = line;
+            try {
+                set_coordinates(
+                    part, begin, end,
+                    [](const osmium::NodeRef &nr) { return nr.location(); });
+            } catch (osmium::geometry_error &e) {
+                // All nodes of the run at the same place
+                begin = end;
+                continue;
+            }
+            if (m_clip) {
+                m_area->clip(part.coordinates, parts);
+                for (auto &coordinates : parts) {
+                    BorderLine clipped = line;
+                    clipped.coordinates = std::move(coordinates);
+                    add_line(std::move(clipped), begin->ref(),
+                             (end - 1)->ref(), out);
+                }
+            } else if (m_area->intersects(part.coordinates)) {
+                add_line(std::move(part), begin->ref(), (end - 1)->ref(),
+                         out);
             }
+            begin = end;
         }
-        return dst;
     }
 
-    std::ostream &m_out;
+    /* This is where the logic that handles tagging lives, getting tags from the way and parent rels.
+     * The output for the way is added to out. Geometry errors are appended
+     * to out.errors instead, so they can be reported in way order. */
+    void write_way(const osmium::Way &way, chunk_output &out) const
+    {
+        const WayLevels *levels = m_way_levels.get(way.id());
+        if (levels == nullptr || levels->empty()) {
+            return;
+        }
+
+        BorderLine line;
+        line.id = way.id();
+        const uint8_t flags = m_rules.way_flags(way.tags()) | levels->flags;
+        line.disputed = flags & TagRules::flag_disputed;
+        line.maritime = flags & TagRules::flag_maritime;
+
+        try {
+            line.admin_level = levels->min_level();
+
+            // Checks if two parents are the same admin level
+            line.dividing_line = levels->dividing_line();
+
+            if (m_area) {
+                write_way_parts(way, line, out);
+                return;
+            }
+
+            // Convert here to ensure errors don't result in partial output lines.
+            set_coordinates(
+                line, way.nodes().begin(), way.nodes().end(),
+                [](const osmium::NodeRef &nr) { return nr.location(); });
+            add_line(std::move(line), way.nodes().front().ref(),
+                     way.nodes().back().ref(), out);
+        } catch (osmium::geometry_error &e) {
+            // The only one set_coordinates() throws
+            ++out.geometry_errors.too_few_points;
+            out.errors += "Geometry error on way ";
+            append_int(out.errors, way.id());
+            out.errors += ": ";
+            out.errors += e.what();
+            out.errors += '\n';
+        } catch (osmium::invalid_location &e) {
+            // Nodes missing from the input end up here
+            ++out.geometry_errors.missing_location;
+            out.errors += "Geometry error on way ";
+            append_int(out.errors, way.id());
+            out.errors += ": invalid location\n";
+        }
+    }
+
+    /// The part of build_linestrings() that runs while the outputs do.
+    void build_and_write(const std::vector<const osmium::Way *> &ways,
+                         unsigned int num_threads)
+    {
+        const size_t num_chunks =
+            (ways.size() + ways_per_chunk - 1) / ways_per_chunk;
+        std::vector<chunk_output> out(num_chunks);
+        std::vector<WayLine> way_lines;
+
+        run_ordered(
+            num_chunks, num_threads,
+            [&](size_t chunk, unsigned int) {
+                const size_t end =
+                    std::min(ways.size(), (chunk + 1) * ways_per_chunk);
+                for (size_t i = chunk * ways_per_chunk; i < end; ++i) {
+                    write_way(*ways[i], out[chunk]);
+                }
+            },
+            [&](size_t chunk) {
+                write_lines(std::move(out[chunk].lines));
+                std::cerr << out[chunk].errors;
+                m_geometry_errors += out[chunk].geometry_errors;
+                m_lines += out[chunk].num_lines;
+                std::move(out[chunk].way_lines.begin(),
+                          out[chunk].way_lines.end(),
+                          std::back_inserter(way_lines));
+                out[chunk] = chunk_output();
+            });
+
+        if (m_merge_lines) {
+            std::vector<BorderLine> lines = merge_lines(std::move(way_lines));
+            m_lines = lines.size();
+            const size_t num_line_chunks =
+                (lines.size() + ways_per_chunk - 1) / ways_per_chunk;
+            std::vector<line_batches> batches(num_line_chunks);
+            run_ordered(
+                num_line_chunks, num_threads,
+                [&](size_t chunk, unsigned int) {
+                    const size_t end =
+                        std::min(lines.size(), (chunk + 1) * ways_per_chunk);
+                    for (size_t i = chunk * ways_per_chunk; i < end; ++i) {
+                        batch_line(std::move(lines[i]), batches[chunk]);
+                    }
+                },
+                [&](size_t chunk) {
+                    write_lines(std::move(batches[chunk]));
+                });
+        }
+
+        // FlatGeobuf and tiles do most of their work at the end, so all
+        // outputs are told first and then finish side by side
+        for (auto &o : m_outputs) {
+            o.writer->end_input();
+        }
+        for (auto &o : m_outputs) {
+            o.writer->finish();
+        }
+    }
 
 public:
     /**
@@ -84,108 +337,239 @@ public:
     {
     public:
         osmium::memory::Buffer &m_ways_buffer;
-        const WayRelations &m_way_rels;
+        IdSet &m_node_ids;
+        const IdSet &m_way_ids;
+        bool m_collect_node_ids = true;
+        uint64_t m_ways_seen = 0;
+        uint64_t m_ways_kept = 0;
 
         explicit HandlerPass2(osmium::memory::Buffer &ways_buffer,
-                              const WayRelations &way_rels)
-        : m_ways_buffer(ways_buffer), m_way_rels(way_rels)
+                              IdSet &node_ids, const IdSet &way_ids)
+        : m_ways_buffer(ways_buffer), m_node_ids(node_ids), m_way_ids(way_ids)
         {
         }
 
+        /// Node IDs aren't needed if the ways already have locations
+        void collect_node_ids(bool collect) { m_collect_node_ids = collect; }
+
         void way(const osmium::Way &way)
         {
-            if (m_way_rels.count(way.id()) > 0) {
+            ++m_ways_seen;
+            if (m_way_ids.get(way.id())) {
+                ++m_ways_kept;
                 m_ways_buffer.add_item(way);
+                m_ways_buffer.commit();
+                if (m_collect_node_ids) {
+                    for (const auto &nr : way.nodes()) {
+                        m_node_ids.set(nr.ref());
+                    }
+                }
             }
         }
     };
 
-    AdminHandler(std::ostream &out)
+    /**
+     * Write the lines to out in the given format. If diff is set, the csv
+     * rows are also compared with an earlier run.
+     */
+    AdminHandler(const TagRules &rules, OutputWriter &out,
+                 output_format format, bool merge_lines = false,
+                 RowDiff *diff = nullptr)
     : m_ways_buffer(initial_buffer_size,
                     osmium::memory::Buffer::auto_grow::yes),
-      m_relations_buffer(initial_buffer_size,
-                         osmium::memory::Buffer::auto_grow::yes),
-      m_handler_pass2(m_ways_buffer, m_way_rels), m_out(out)
-    {
-    }
-
-    /* This is where the logic that handles tagging lives, getting tags from the way and parent rels */
-    void way(const osmium::Way &way)
-    {
-        std::vector<int> parent_admin_levels;
-        bool disputed = false;
-        bool maritime = false;
-
-        // Tags on the way itself
-        disputed = disputed || way.tags().has_tag("disputed", "yes");
-        disputed = disputed || way.tags().has_tag("dispute", "yes");
-        disputed = disputed || way.tags().has_tag("border_status", "dispute");
-        disputed = disputed || way.tags().has_key("disputed_by");
-
-        maritime = maritime || way.tags().has_tag("maritime", "yes");
-        maritime = maritime || way.tags().has_tag("natural", "coastline");
-        maritime = maritime || way.tags().has_tag("boundary_type", "maritime");
-
-        // Tags on the parent relations
-        for (const auto &rel_offset : m_way_rels[way.id()]) {
-            const osmium::TagList &tags =
-                m_relations_buffer.get<const osmium::Relation>(rel_offset)
-                    .tags();
-            const char *admin_level = tags.get_value_by_key("admin_level", "");
-            /* can't use admin_levels[] because [] is non-const, but there must be a better way? */
-            auto admin_it = admin_levels.find(admin_level);
-            if (admin_it != admin_levels.end()) {
-                parent_admin_levels.push_back(admin_it->second);
+      m_merge_lines(merge_lines), m_rules(rules),
+      m_handler_pass2(m_ways_buffer, m_node_ids, m_way_ids)
+    {
+        m_outputs.push_back(output{
+            0.0, std::unique_ptr<LineWriter>{new LineWriter{
+                     make_line_sink(out, format, merge_lines, diff)}}});
+    }
+
+    /// Write the lines to vector tiles.
+    AdminHandler(const TagRules &rules, mvt::TileSet &tiles,
+                 bool merge_lines = false)
+    : m_ways_buffer(initial_buffer_size,
+                    osmium::memory::Buffer::auto_grow::yes),
+      m_merge_lines(merge_lines), m_rules(rules),
+      m_handler_pass2(m_ways_buffer, m_node_ids, m_way_ids)
+    {
+        m_outputs.push_back(
+            output{0.0, std::unique_ptr<LineWriter>{
+                            new LineWriter{make_tile_sink(tiles)}}});
+    }
+
+    /**
+     * Also write all lines to out in the given format. The lines are built
+     * once and each output formats them on its own thread, so an extra
+     * output costs the geometry workers nothing.
+     */
+    void add_output(OutputWriter &out, output_format format)
+    {
+        m_outputs.push_back(output{
+            0.0, std::unique_ptr<LineWriter>{new LineWriter{
+                     make_line_sink(out, format, m_merge_lines)}}});
+    }
+
+    /**
+     * Also write the lines, simplified with the given tolerance in
+     * projected units, to out.
+     */
+    void add_simplified_output(OutputWriter &out, output_format format,
+                               double tolerance)
+    {
+        m_outputs.push_back(output{
+            tolerance, std::unique_ptr<LineWriter>{new LineWriter{
+                           make_line_sink(out, format, m_merge_lines)}}});
+    }
+
+    /// Fill state with what is needed to apply change files later.
+    void keep_state(BorderState &state) { m_state = &state; }
+
+    /**
+     * Only write the parts of lines that reach into area, clipped to it if
+     * clip is set. Nodes outside the area and its buffer are treated as
+     * missing, not as errors.
+     */
+    void set_extract(const ExtractArea &area, bool clip)
+    {
+        m_area = &area;
+        m_clip = clip;
+    }
+
+    void relation(const osmium::Relation &relation)
+    {
+        ++m_relations_seen;
+        const TagRules::relation_class rc =
+            m_rules.classify_relation(relation.tags());
+        // Relations without a usable admin_level or flags can't contribute
+        // to the output, so their ways don't need to be kept.
+        if (rc.admin_level < 0 && rc.flags == 0) {
+            return;
+        }
+        ++m_relations_kept;
+        BorderState::relation *state = nullptr;
+        if (m_state) {
+            state = &m_state->relations()[relation.id()];
+            state->admin_level = rc.admin_level;
+            state->flags = rc.flags;
+        }
+        for (const auto &rm : relation.members()) {
+            if (rm.type() == osmium::item_type::way) {
+                if (rc.admin_level >= 0) {
+                    m_way_levels.add(rm.ref(), rc.admin_level);
+                    m_way_ids.set(rm.ref());
+                }
+                if (rc.flags) {
+                    m_way_levels.add_flags(rm.ref(), rc.flags);
+                }
+                if (state) {
+                    state->ways.push_back(rm.ref());
+                }
             }
         }
+    }
 
-        if (parent_admin_levels.size() > 0) {
-            try {
-                // Sort for both min parent admin level and if it divides areas
-                std::sort(parent_admin_levels.begin(),
-                          parent_admin_levels.end());
-                const int min_parent_admin_level = parent_admin_levels[0];
-
-                // Checks if two parents are the same admin level
-                const bool dividing_line =
-                    std::adjacent_find(parent_admin_levels.begin(),
-                                       parent_admin_levels.end()) !=
-                    parent_admin_levels.end();
-
-                // Convert here to ensure errors don't result in partial output lines.
-                const std::string linestring = m_factory.create_linestring(way);
-
-                m_out << way.id() << "\t"
-                      // parent_admin_levels is already escaped.
-                      << min_parent_admin_level << "\t"
-                      << ((dividing_line) ? ("true") : ("false")) << "\t"
-                      << ((disputed) ? ("true") : ("false")) << "\t"
-                      << ((maritime) ? ("true") : ("false")) << "\t"
-                      << linestring << "\n";
-            } catch (osmium::geometry_error &e) {
-                std::cerr << "Geometry error on way " << way.id() << ": "
-                          << e.what() << "\n";
+    /// Must be called between pass 1 and pass 2.
+    void prepare_way_levels() { m_way_levels.prepare(); }
+
+    /**
+     * Only keep the ways of shard index of count in pass 2. Must be called
+     * after prepare_way_levels(). The border ways are split into count
+     * ranges of way IDs with about the same number of ways each, so all
+     * shards of the same input agree on the ranges. Returns the number of
+     * ways in the shard.
+     */
+    size_t restrict_to_shard(unsigned int index, unsigned int count)
+    {
+        const std::vector<osmium::object_id_type> ids = m_way_levels.ids();
+        const size_t begin = ids.size() * index / count;
+        const size_t end = ids.size() * (index + 1) / count;
+        m_way_ids = IdSet();
+        for (size_t i = begin; i < end; ++i) {
+            m_way_ids.set(ids[i]);
+        }
+        return end - begin;
+    }
+
+    const WayLevelsTable &get_way_levels() const { return m_way_levels; }
+
+    osmium::memory::Buffer &get_ways() { return m_ways_buffer; }
+
+    const IdSet &get_way_ids() const { return m_way_ids; }
+
+    const IdSet &get_node_ids() const
+    {
+        return m_node_ids;
+    }
+
+    uint64_t relations_seen() const { return m_relations_seen; }
+
+    /// Relations with a usable admin_level or flags for their ways
+    uint64_t relations_kept() const { return m_relations_kept; }
+
+    /// Number of lines written by build_linestrings()
+    uint64_t lines_written() const { return m_lines; }
+
+    const GeometryErrors &geometry_errors() const
+    {
+        return m_geometry_errors;
+    }
+
+    /**
+     * Build the linestrings for all ways kept in pass 2 and write them out.
+     * The node locations must already have been set on the ways.
+     *
+     * The ways are split into chunks that are processed on num_threads
+     * threads. Output is written in the order of the ways in the buffer, so
+     * it is the same for any number of threads. When merging lines, all of
+     * them are built first, then merged, then simplified in parallel again.
+     * Each output formats and writes the lines on a thread of its own.
+     */
+    void build_linestrings(unsigned int num_threads)
+    {
+        std::vector<const osmium::Way *> ways;
+        for (auto it = m_ways_buffer.begin<osmium::Way>();
+             it != m_ways_buffer.end<osmium::Way>(); ++it) {
+            ways.push_back(&*it);
+        }
+
+        for (auto &o : m_outputs) {
+            o.writer->begin();
+        }
+        try {
+            build_and_write(ways, num_threads);
+        } catch (...) {
+            // The outputs may not outlive this handler
+            for (auto &o : m_outputs) {
+                o.writer->cancel();
             }
+            throw;
         }
     }
 
-    void relation(const osmium::Relation &relation)
+    /**
+     * Add the ways kept in pass 2 and the locations of their nodes to the
+     * state passed to keep_state(). The node locations must already have
+     * been set on the ways.
+     */
+    void fill_state()
     {
-        if (relation.tags().has_tag("boundary", "administrative")) {
-            m_relations_buffer.add_item(relation);
-            auto relation_offset = m_relations_buffer.commit();
-            for (const auto &rm : relation.members()) {
-                if (rm.type() == osmium::item_type::way) {
-                    // Calls the default constructor if it doesn't exist, otherwise add to the back
-                    // TODO: Can this call the constructor to create a vector of size N, where N=2?
-                    m_way_rels[rm.ref()].push_back(relation_offset);
+        for (auto it = m_ways_buffer.begin<osmium::Way>();
+             it != m_ways_buffer.end<osmium::Way>(); ++it) {
+            const uint8_t flags = m_rules.way_flags(it->tags());
+            BorderState::way &way = m_state->ways()[it->id()];
+            way.disputed = flags & TagRules::flag_disputed;
+            way.maritime = flags & TagRules::flag_maritime;
+            for (const auto &nr : it->nodes()) {
+                way.nodes.push_back(nr.ref());
+                if (nr.location().valid()) {
+                    m_state->add_node(nr.ref(), nr.location());
                 }
             }
         }
+        m_state->prepare_nodes();
     }
 
-    osmium::memory::Buffer &get_ways() { return m_ways_buffer; }
-
     void flush() {}
     // Handler for the pass2 ways
     HandlerPass2 m_handler_pass2;
@@ -0,0 +1,700 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <system_error>
+
+#include <zlib.h>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "blobindex.hpp"
+#include "parallel.hpp"
+
+namespace {
+
+const char magic[8] = {'O', 'S', 'M', 'B', 'B', 'I', 'D', 'X'};
+const uint32_t index_version = 1;
+
+// Limits from the PBF format description
+const uint32_t max_blob_header_size = 64 * 1024;
+const uint32_t max_uncompressed_blob_size = 32 * 1024 * 1024;
+
+// Number of blobs handed to a worker thread at a time
+const size_t blobs_per_chunk = 16;
+
+struct pbf_error : std::runtime_error
+{
+    explicit pbf_error(const std::string &what)
+    : std::runtime_error("Invalid PBF data: " + what)
+    {
+    }
+};
+
+/// Just enough of a protobuf decoder to find the IDs in a PBF file
+class pbf_message
+{
+    const char *m_data;
+    const char *m_end;
+    uint32_t m_field = 0;
+    uint32_t m_wire_type = 0;
+
+public:
+    pbf_message(const char *data, size_t size)
+    : m_data(data), m_end(data + size)
+    {
+    }
+
+    bool next()
+    {
+        if (m_data == m_end) {
+            return false;
+        }
+        const uint64_t key = varint();
+        m_field = static_cast<uint32_t>(key >> 3);
+        m_wire_type = static_cast<uint32_t>(key & 7);
+        return true;
+    }
+
+    uint32_t field() const { return m_field; }
+
+    uint32_t wire_type() const { return m_wire_type; }
+
+    uint64_t varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (m_data == m_end) {
+                throw pbf_error{"truncated varint"};
+            }
+            const unsigned char byte = static_cast<unsigned char>(*m_data++);
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw pbf_error{"varint too long"};
+    }
+
+    pbf_message message()
+    {
+        const uint64_t size = varint();
+        if (size > static_cast<uint64_t>(m_end - m_data)) {
+            throw pbf_error{"truncated message"};
+        }
+        const char *data = m_data;
+        m_data += size;
+        return pbf_message{data, static_cast<size_t>(size)};
+    }
+
+    std::string string()
+    {
+        const pbf_message m = message();
+        return std::string(m.m_data, m.m_end);
+    }
+
+    const char *data() const { return m_data; }
+
+    size_t size() const { return static_cast<size_t>(m_end - m_data); }
+
+    void skip()
+    {
+        switch (m_wire_type) {
+        case 0:
+            varint();
+            break;
+        case 1:
+            advance(8);
+            break;
+        case 2:
+            message();
+            break;
+        case 5:
+            advance(4);
+            break;
+        default:
+            throw pbf_error{"unknown wire type"};
+        }
+    }
+
+private:
+    void advance(size_t size)
+    {
+        if (size > this->size()) {
+            throw pbf_error{"truncated field"};
+        }
+        m_data += size;
+    }
+};
+
+int64_t zigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void add_id(BlobIndex::blob &b, osmium::osm_entity_bits::type type,
+            osmium::object_id_type id)
+{
+    b.types |= type;
+    b.min_id = std::min(b.min_id, id);
+    b.max_id = std::max(b.max_id, id);
+}
+
+/// The first field of an OSM object message is its ID
+osmium::object_id_type object_id(pbf_message object, bool sint)
+{
+    while (object.next()) {
+        if (object.field() == 1 && object.wire_type() == 0) {
+            const uint64_t value = object.varint();
+            return sint ? zigzag(value) : static_cast<int64_t>(value);
+        }
+        object.skip();
+    }
+    throw pbf_error{"object without ID"};
+}
+
+void scan_group(pbf_message group, BlobIndex::blob &b)
+{
+    while (group.next()) {
+        if (group.wire_type() != 2) {
+            group.skip();
+            continue;
+        }
+        switch (group.field()) {
+        case 1:
+            add_id(b, osmium::osm_entity_bits::node,
+                   object_id(group.message(), true));
+            break;
+        case 2: {
+            pbf_message dense = group.message();
+            while (dense.next()) {
+                if (dense.field() != 1 || dense.wire_type() != 2) {
+                    dense.skip();
+                    continue;
+                }
+                // Delta coded IDs
+                pbf_message ids = dense.message();
+                int64_t id = 0;
+                while (ids.size() > 0) {
+                    id += zigzag(ids.varint());
+                    add_id(b, osmium::osm_entity_bits::node, id);
+                }
+            }
+            break;
+        }
+        case 3:
+            add_id(b, osmium::osm_entity_bits::way,
+                   object_id(group.message(), false));
+            break;
+        case 4:
+            add_id(b, osmium::osm_entity_bits::relation,
+                   object_id(group.message(), false));
+            break;
+        default:
+            group.skip();
+        }
+    }
+}
+
+/**
+ * Fill in the types and IDs of a data blob. Blobs that can't be decoded
+ * here, like those with compression other than zlib, get all types and
+ * IDs so they are always read.
+ */
+void scan_blob(const std::string &data, BlobIndex::blob &b)
+{
+    b.types = osmium::osm_entity_bits::nothing;
+    b.min_id = std::numeric_limits<osmium::object_id_type>::max();
+    b.max_id = std::numeric_limits<osmium::object_id_type>::min();
+
+    std::string uncompressed;
+    const char *block = nullptr;
+    size_t block_size = 0;
+    uint64_t raw_size = 0;
+    pbf_message blob{data.data(), data.size()};
+    while (blob.next()) {
+        if (blob.field() == 1 && blob.wire_type() == 2) {
+            const pbf_message raw = blob.message();
+            block = raw.data();
+            block_size = raw.size();
+        } else if (blob.field() == 2 && blob.wire_type() == 0) {
+            raw_size = blob.varint();
+        } else if (blob.field() == 3 && blob.wire_type() == 2) {
+            const pbf_message compressed = blob.message();
+            if (raw_size == 0 || raw_size > max_uncompressed_blob_size) {
+                throw pbf_error{"bad blob size"};
+            }
+            uncompressed.resize(raw_size);
+            uLongf size = static_cast<uLongf>(raw_size);
+            if (::uncompress(
+                    reinterpret_cast<Bytef *>(&uncompressed[0]), &size,
+                    reinterpret_cast<const Bytef *>(compressed.data()),
+                    static_cast<uLong>(compressed.size())) != Z_OK ||
+                size != raw_size) {
+                throw pbf_error{"failed to decompress blob"};
+            }
+            block = uncompressed.data();
+            block_size = uncompressed.size();
+        } else {
+            blob.skip();
+        }
+    }
+
+    if (block == nullptr) {
+        b.types = osmium::osm_entity_bits::nwr;
+        std::swap(b.min_id, b.max_id);
+        return;
+    }
+
+    pbf_message primitive_block{block, block_size};
+    while (primitive_block.next()) {
+        if (primitive_block.field() == 2 && primitive_block.wire_type() == 2) {
+            scan_group(primitive_block.message(), b);
+        } else {
+            primitive_block.skip();
+        }
+    }
+}
+
+#ifndef _MSC_VER
+
+void read_at(int fd, uint64_t offset, char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t length =
+            ::pread(fd, data, size, static_cast<off_t>(offset));
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length < 0) {
+            throw std::system_error{errno, std::system_category(),
+                                    "Read failed"};
+        }
+        if (length == 0) {
+            throw pbf_error{"unexpected end of file"};
+        }
+        data += length;
+        size -= static_cast<size_t>(length);
+        offset += static_cast<uint64_t>(length);
+    }
+}
+
+/// Returns false if the other end of the pipe was closed
+bool write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t length = ::write(fd, data, size);
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length < 0 && errno == EPIPE) {
+            return false;
+        }
+        if (length < 0) {
+            throw std::system_error{errno, std::system_category(),
+                                    "Write failed"};
+        }
+        data += length;
+        size -= static_cast<size_t>(length);
+    }
+    return true;
+}
+
+class file_descriptor
+{
+    int m_fd;
+
+public:
+    explicit file_descriptor(const std::string &filename)
+    : m_fd(::open(filename.c_str(), O_RDONLY))
+    {
+        if (m_fd < 0) {
+            throw std::system_error{errno, std::system_category(),
+                                    "Open failed for '" + filename + "'"};
+        }
+    }
+
+    ~file_descriptor() { ::close(m_fd); }
+
+    file_descriptor(const file_descriptor &) = delete;
+    file_descriptor &operator=(const file_descriptor &) = delete;
+
+    int get() const { return m_fd; }
+};
+
+#endif // _MSC_VER
+
+void append_uint(std::string &out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) {
+        out += static_cast<char>(value >> (8 * i));
+    }
+}
+
+uint64_t read_uint(const char *&data, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= uint64_t(static_cast<unsigned char>(*data++)) << (8 * i);
+    }
+    return value;
+}
+
+const size_t blob_record_size = 8 + 8 + 1 + 8 + 8;
+
+void append_blob(std::string &out, const BlobIndex::blob &b)
+{
+    append_uint(out, b.offset, 8);
+    append_uint(out, b.size, 8);
+    append_uint(out, b.types, 1);
+    append_uint(out, static_cast<uint64_t>(b.min_id), 8);
+    append_uint(out, static_cast<uint64_t>(b.max_id), 8);
+}
+
+BlobIndex::blob read_blob(const char *&data)
+{
+    BlobIndex::blob b;
+    b.offset = read_uint(data, 8);
+    b.size = read_uint(data, 8);
+    b.types = static_cast<unsigned char>(read_uint(data, 1));
+    b.min_id = static_cast<osmium::object_id_type>(read_uint(data, 8));
+    b.max_id = static_cast<osmium::object_id_type>(read_uint(data, 8));
+    return b;
+}
+
+} // anonymous namespace
+
+#ifndef _MSC_VER
+
+bool BlobIndex::open(const std::string &filename, unsigned int num_threads)
+{
+    m_filename = filename;
+    m_blobs.clear();
+    m_loaded = false;
+
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can't access '" + filename + "'"};
+    }
+    const uint64_t file_size = static_cast<uint64_t>(st.st_size);
+    const int64_t mtime = static_cast<int64_t>(st.st_mtime);
+
+    const std::string index_filename = filename + ".blobidx";
+    if (load(index_filename, file_size, mtime)) {
+        m_loaded = true;
+        return true;
+    }
+
+    // A PBF file starts with the size of the first blob header, which is
+    // followed by the type of the first blob, "OSMHeader"
+    {
+        file_descriptor fd{filename};
+        char start[4 + 2 + 9];
+        try {
+            read_at(fd.get(), 0, start, sizeof(start));
+        } catch (const pbf_error &) {
+            m_filename.clear();
+            return false;
+        }
+        if (start[4] != 0x0a || start[5] != 9 ||
+            std::memcmp(start + 6, "OSMHeader", 9) != 0) {
+            m_filename.clear();
+            return false;
+        }
+    }
+
+    build(num_threads);
+    try {
+        save(index_filename, file_size, mtime);
+    } catch (const std::runtime_error &e) {
+        std::cerr << "Warning: " << e.what() << "\n";
+    }
+    return true;
+}
+
+#endif // _MSC_VER
+
+bool BlobIndex::load(const std::string &index_filename, uint64_t file_size,
+                     int64_t mtime)
+{
+    std::ifstream in(index_filename, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+
+    const size_t fixed_size =
+        sizeof(magic) + 4 + 8 + 8 + blob_record_size + 8;
+    if (data.size() < fixed_size ||
+        std::memcmp(data.data(), magic, sizeof(magic)) != 0) {
+        return false;
+    }
+    const char *p = data.data() + sizeof(magic);
+    if (read_uint(p, 4) != index_version || read_uint(p, 8) != file_size ||
+        static_cast<int64_t>(read_uint(p, 8)) != mtime) {
+        return false;
+    }
+    m_header = read_blob(p);
+    const uint64_t count = read_uint(p, 8);
+    if (count != (data.size() - fixed_size) / blob_record_size ||
+        (data.size() - fixed_size) % blob_record_size != 0) {
+        return false;
+    }
+    m_blobs.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        m_blobs.push_back(read_blob(p));
+    }
+    return true;
+}
+
+void BlobIndex::save(const std::string &index_filename, uint64_t file_size,
+                     int64_t mtime) const
+{
+    std::string data(magic, sizeof(magic));
+    append_uint(data, index_version, 4);
+    append_uint(data, file_size, 8);
+    append_uint(data, static_cast<uint64_t>(mtime), 8);
+    append_blob(data, m_header);
+    append_uint(data, m_blobs.size(), 8);
+    for (const auto &b : m_blobs) {
+        append_blob(data, b);
+    }
+
+    const std::string tmp_filename = index_filename + ".tmp";
+    std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    out.close();
+    if (out.fail() ||
+        std::rename(tmp_filename.c_str(), index_filename.c_str()) != 0) {
+        std::remove(tmp_filename.c_str());
+        throw std::runtime_error{"Can't save blob index '" +
+                                 index_filename + "'"};
+    }
+}
+
+#ifndef _MSC_VER
+
+void BlobIndex::build(unsigned int num_threads)
+{
+    file_descriptor fd{m_filename};
+
+    // Find all blobs, which only needs the blob headers
+    struct stat st;
+    if (::fstat(fd.get(), &st) != 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can't access '" + m_filename + "'"};
+    }
+    const uint64_t file_size = static_cast<uint64_t>(st.st_size);
+    std::vector<uint64_t> data_offsets;
+    std::string header;
+    uint64_t offset = 0;
+    bool first = true;
+    while (offset < file_size) {
+        char size_data[4];
+        read_at(fd.get(), offset, size_data, sizeof(size_data));
+        const uint32_t header_size =
+            (uint32_t(static_cast<unsigned char>(size_data[0])) << 24) |
+            (uint32_t(static_cast<unsigned char>(size_data[1])) << 16) |
+            (uint32_t(static_cast<unsigned char>(size_data[2])) << 8) |
+            uint32_t(static_cast<unsigned char>(size_data[3]));
+        if (header_size > max_blob_header_size) {
+            throw pbf_error{"blob header too large"};
+        }
+        header.resize(header_size);
+        read_at(fd.get(), offset + 4, &header[0], header_size);
+
+        std::string type;
+        uint64_t data_size = 0;
+        pbf_message blob_header{header.data(), header.size()};
+        while (blob_header.next()) {
+            if (blob_header.field() == 1 && blob_header.wire_type() == 2) {
+                type = blob_header.string();
+            } else if (blob_header.field() == 3 &&
+                       blob_header.wire_type() == 0) {
+                data_size = blob_header.varint();
+            } else {
+                blob_header.skip();
+            }
+        }
+
+        const blob b{offset, 4 + header_size + data_size, 0, 0, 0};
+        if (b.size > file_size - offset) {
+            throw pbf_error{"truncated file"};
+        }
+        if (first) {
+            if (type != "OSMHeader") {
+                throw pbf_error{"missing OSMHeader"};
+            }
+            m_header = b;
+            first = false;
+        } else if (type == "OSMData") {
+            m_blobs.push_back(b);
+            data_offsets.push_back(offset + 4 + header_size);
+        }
+        offset += b.size;
+    }
+
+    // Then decompress the data blobs to find their contents
+    const size_t num_chunks =
+        (m_blobs.size() + blobs_per_chunk - 1) / blobs_per_chunk;
+    run_ordered(
+        num_chunks, num_threads,
+        [&](size_t chunk, unsigned int) {
+            std::string data;
+            const size_t end =
+                std::min(m_blobs.size(), (chunk + 1) * blobs_per_chunk);
+            for (size_t i = chunk * blobs_per_chunk; i < end; ++i) {
+                blob &b = m_blobs[i];
+                data.resize(b.offset + b.size - data_offsets[i]);
+                read_at(fd.get(), data_offsets[i], &data[0], data.size());
+                scan_blob(data, b);
+            }
+        },
+        [](size_t) {});
+}
+
+std::unique_ptr<BlobSource>
+BlobIndex::select(osmium::osm_entity_bits::type types, const IdSet *ids) const
+{
+    if (m_filename.empty()) {
+        return nullptr;
+    }
+    std::vector<blob> selected{m_header};
+    for (const auto &b : m_blobs) {
+        if ((b.types & types) && (!ids || ids->any_in(b.min_id, b.max_id))) {
+            selected.push_back(b);
+        }
+    }
+    return std::unique_ptr<BlobSource>{
+        new BlobSource{m_filename, std::move(selected)}};
+}
+
+BlobSource::BlobSource(const std::string &filename,
+                       std::vector<BlobIndex::blob> blobs)
+: m_filename(filename), m_num_blobs(blobs.size())
+{
+    // Neighbouring blobs are copied in one go
+    for (const auto &b : blobs) {
+        if (!m_blobs.empty() &&
+            m_blobs.back().offset + m_blobs.back().size == b.offset) {
+            m_blobs.back().size += b.size;
+        } else {
+            m_blobs.push_back(b);
+        }
+        m_size += b.size;
+    }
+
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can't create pipe"};
+    }
+    m_read_fd = fds[0];
+    m_write_fd = fds[1];
+    m_thread = std::thread(&BlobSource::run, this);
+}
+
+BlobSource::~BlobSource()
+{
+    // The reader has closed its own descriptor for the pipe by now, so
+    // this makes any further writes fail
+    ::close(m_read_fd);
+    m_thread.join();
+}
+
+osmium::io::File BlobSource::file() const
+{
+    return osmium::io::File{"/dev/fd/" + std::to_string(m_read_fd), "pbf"};
+}
+
+void BlobSource::run()
+{
+    // Writing to a pipe nobody reads from anymore raises SIGPIPE. Blocking
+    // it on this thread turns that into an EPIPE error instead.
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    try {
+        file_descriptor fd{m_filename};
+        std::string buffer(1024 * 1024, '\0');
+        for (const auto &b : m_blobs) {
+            for (uint64_t done = 0; done < b.size;) {
+                const size_t size = static_cast<size_t>(
+                    std::min<uint64_t>(buffer.size(), b.size - done));
+                read_at(fd.get(), b.offset + done, &buffer[0], size);
+                if (!write_all(m_write_fd, buffer.data(), size)) {
+                    ::close(m_write_fd);
+                    return;
+                }
+                done += size;
+            }
+        }
+    } catch (const std::exception &e) {
+        // The reader sees a truncated file and reports that
+        std::cerr << "Error reading '" << m_filename << "': " << e.what()
+                  << "\n";
+    }
+    ::close(m_write_fd);
+}
+
+#else
+
+// Copying the selected blobs needs pread() and pipes, so on Windows there
+// is no blob index and the input is always read directly.
+
+bool BlobIndex::open(const std::string &, unsigned int)
+{
+    m_filename.clear();
+    m_blobs.clear();
+    m_loaded = false;
+    return false;
+}
+
+std::unique_ptr<BlobSource> BlobIndex::select(osmium::osm_entity_bits::type,
+                                              const IdSet *) const
+{
+    return nullptr;
+}
+
+BlobSource::~BlobSource() {}
+
+osmium::io::File BlobSource::file() const
+{
+    return osmium::io::File{m_filename, "pbf"};
+}
+
+#endif // _MSC_VER
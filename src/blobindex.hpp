@@ -0,0 +1,135 @@
+#ifndef BLOBINDEX_HPP
+#define BLOBINDEX_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <osmium/io/file.hpp>
+#include <osmium/osm/entity_bits.hpp>
+#include <osmium/osm/types.hpp>
+
+#include "idset.hpp"
+
+class BlobSource;
+
+/**
+ * Index of the blobs in a PBF file with the types of objects and the range
+ * of IDs in each of them.
+ *
+ * Building the index means decompressing the whole file once, so it is
+ * saved next to the input with ".blobidx" appended to the name and reused
+ * as long as the input doesn't change. Each pass can then read only the
+ * blobs with the objects it needs through a BlobSource.
+ */
+class BlobIndex
+{
+public:
+    struct blob
+    {
+        /// Offset of the blob in the file, including its header
+        uint64_t offset;
+        /// Size of the blob, including its header
+        uint64_t size;
+        /// osmium::osm_entity_bits of the objects in the blob
+        unsigned char types;
+        osmium::object_id_type min_id;
+        osmium::object_id_type max_id;
+    };
+
+    /**
+     * Load or build the index for a file. Returns false if it isn't a PBF
+     * file, and always on Windows, where blob indexes aren't supported.
+     * Building the index uses num_threads threads. Throws
+     * std::runtime_error if the file can't be read or isn't valid PBF.
+     * Failing to save the index is only reported on std::cerr.
+     */
+    bool open(const std::string &filename, unsigned int num_threads);
+
+    /// Whether the index was loaded from the sidecar file by open()
+    bool loaded() const { return m_loaded; }
+
+    const std::vector<blob> &blobs() const { return m_blobs; }
+
+    /**
+     * Start reading the blobs with objects of the given types, and if ids is
+     * given, with an ID range that contains one of them. Returns nullptr if
+     * there is no index, in which case the file should be read directly.
+     */
+    std::unique_ptr<BlobSource> select(osmium::osm_entity_bits::type types,
+                                       const IdSet *ids = nullptr) const;
+
+private:
+    std::string m_filename;
+    blob m_header{0, 0, 0, 0, 0};
+    std::vector<blob> m_blobs;
+    bool m_loaded = false;
+
+    bool load(const std::string &index_filename, uint64_t file_size,
+              int64_t mtime);
+    void build(unsigned int num_threads);
+    void save(const std::string &index_filename, uint64_t file_size,
+              int64_t mtime) const;
+};
+
+/**
+ * Copies some blobs of a PBF file into a pipe from a background thread, so
+ * they can be read by osmium as a PBF file of their own. The blobs are
+ * copied as they are, without decompressing them.
+ */
+class BlobSource
+{
+public:
+    BlobSource(const std::string &filename,
+               std::vector<BlobIndex::blob> blobs);
+
+    /// Stops copying if the reader didn't read everything.
+    ~BlobSource();
+
+    BlobSource(const BlobSource &) = delete;
+    BlobSource &operator=(const BlobSource &) = delete;
+
+    /// The file to give to osmium::io::Reader
+    osmium::io::File file() const;
+
+    /// Number of bytes that will be read
+    uint64_t size() const { return m_size; }
+
+    /// Number of blobs that will be read, including the header
+    size_t num_blobs() const { return m_num_blobs; }
+
+private:
+    std::string m_filename;
+    std::vector<BlobIndex::blob> m_blobs;
+    uint64_t m_size = 0;
+    size_t m_num_blobs = 0;
+    int m_read_fd = -1;
+    int m_write_fd = -1;
+    std::thread m_thread;
+
+    void run();
+};
+
+#endif // BLOBINDEX_HPP
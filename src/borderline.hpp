@@ -0,0 +1,76 @@
+#ifndef BORDERLINE_HPP
+#define BORDERLINE_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <vector>
+
+#include <osmium/geom/coordinates.hpp>
+#include <osmium/geom/factory.hpp>
+#include <osmium/geom/mercator_projection.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+
+/**
+ * One line of output: the attributes of a border way and its geometry in
+ * web mercator.
+ */
+struct BorderLine
+{
+    osmium::object_id_type id = 0;
+    int admin_level = 0;
+    bool dividing_line = false;
+    bool disputed = false;
+    bool maritime = false;
+    std::vector<osmium::geom::Coordinates> coordinates;
+    /// IDs of the ways merged into the line, empty unless lines are merged
+    std::vector<osmium::object_id_type> way_ids;
+};
+
+/**
+ * Set the coordinates of a line from the locations of its nodes, skipping
+ * repeated locations the same way the WKB factory does. get_location maps
+ * each element of the range to its osmium::Location.
+ *
+ * Throws osmium::invalid_location if a node has no location and
+ * osmium::geometry_error if fewer than two points are left.
+ */
+template <typename TIterator, typename TGetLocation>
+void set_coordinates(BorderLine &line, TIterator begin, TIterator end,
+                     TGetLocation get_location)
+{
+    const osmium::geom::MercatorProjection projection;
+    line.coordinates.clear();
+    osmium::Location last;
+    for (auto it = begin; it != end; ++it) {
+        const osmium::Location location = get_location(*it);
+        if (line.coordinates.empty() || location != last) {
+            line.coordinates.push_back(projection(location));
+            last = location;
+        }
+    }
+    if (line.coordinates.size() < 2) {
+        throw osmium::geometry_error{
+            "need at least two points for linestring"};
+    }
+}
+
+#endif // BORDERLINE_HPP
@@ -0,0 +1,329 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#include <osmium/index/index.hpp>
+#include <osmium/index/map.hpp>
+
+#include "compactmap.hpp"
+
+namespace {
+
+void append_varint(unsigned char *&out, uint64_t value)
+{
+    while (value >= 0x80) {
+        *out++ = static_cast<unsigned char>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<unsigned char>(value);
+}
+
+uint64_t read_varint(const unsigned char *&in)
+{
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        const unsigned char byte = *in++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^
+           static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// The lowest bit of the x varint is set if the ID is one more than the
+// previous one, which it mostly is in runs of new nodes. Otherwise the ID
+// difference minus 2 follows.
+void append_entry(unsigned char *&out, uint64_t id_delta, int64_t dx,
+                  int64_t dy)
+{
+    append_varint(out, (zigzag(dx) << 1) | (id_delta == 1 ? 1 : 0));
+    if (id_delta != 1) {
+        append_varint(out, id_delta - 2);
+    }
+    append_varint(out, zigzag(dy));
+}
+
+void read_entry(const unsigned char *&in, uint64_t &id, int64_t &x,
+                int64_t &y)
+{
+    const uint64_t xv = read_varint(in);
+    x += unzigzag(xv >> 1);
+    id += (xv & 1) ? 1 : read_varint(in) + 2;
+    y += unzigzag(read_varint(in));
+}
+
+bool entry_less(const std::pair<osmium::unsigned_object_id_type,
+                                osmium::Location> &a,
+                const std::pair<osmium::unsigned_object_id_type,
+                                osmium::Location> &b)
+{
+    return a.first < b.first;
+}
+
+} // anonymous namespace
+
+void CompactLocationMap::register_type()
+{
+    osmium::index::MapFactory<id_type, osmium::Location>::instance()
+        .register_map("compact_mem_array", [](const std::vector<std::string> &) {
+            return new CompactLocationMap();
+        });
+}
+
+void CompactLocationMap::set(const id_type id, const osmium::Location value)
+{
+    if ((!m_blocks.empty() || !m_pending.empty()) && id <= m_last_id) {
+        m_unsorted.emplace_back(id, value);
+    } else {
+        m_pending.emplace_back(id, value);
+        ++m_packed_size;
+        m_last_id = id;
+        if (m_pending.size() == block_size) {
+            encode_pending();
+        }
+    }
+    ++m_size;
+}
+
+void CompactLocationMap::encode_pending()
+{
+    if (m_pending.empty()) {
+        return;
+    }
+    if (chunk_size - m_chunk_used < max_block_bytes) {
+        m_chunks.emplace_back(new unsigned char[chunk_size]);
+        m_chunk_used = 0;
+    }
+
+    const entry &first = m_pending.front();
+    block b;
+    b.first_id = first.first;
+    b.offset = (m_chunks.size() - 1) * chunk_size + m_chunk_used;
+    b.x = first.second.x();
+    b.y = first.second.y();
+    m_blocks.push_back(b);
+
+    unsigned char *const start = m_chunks.back().get() + m_chunk_used;
+    unsigned char *out = start;
+    *out++ = static_cast<unsigned char>(m_pending.size());
+    for (size_t i = 1; i < m_pending.size(); ++i) {
+        const entry &previous = m_pending[i - 1];
+        const entry &e = m_pending[i];
+        append_entry(out, e.first - previous.first,
+                     int64_t(e.second.x()) - int64_t(previous.second.x()),
+                     int64_t(e.second.y()) - int64_t(previous.second.y()));
+    }
+    m_chunk_used += static_cast<size_t>(out - start);
+    m_pending.clear();
+}
+
+bool CompactLocationMap::find_packed(const id_type id,
+                                     osmium::Location &location) const
+{
+    // The last block whose first ID isn't after id
+    auto it = std::upper_bound(
+        m_blocks.begin(), m_blocks.end(), id,
+        [](const id_type i, const block &b) { return i < b.first_id; });
+    if (it != m_blocks.begin()) {
+        const block &b = *(it - 1);
+        id_type current = b.first_id;
+        int64_t x = b.x;
+        int64_t y = b.y;
+        const unsigned char *in =
+            m_chunks[b.offset / chunk_size].get() + b.offset % chunk_size;
+        const size_t count = *in++;
+        for (size_t i = 1; current < id && i < count; ++i) {
+            read_entry(in, current, x, y);
+        }
+        if (current == id) {
+            location = osmium::Location{static_cast<int32_t>(x),
+                                        static_cast<int32_t>(y)};
+            return true;
+        }
+    }
+
+    for (const auto &e : m_pending) {
+        if (e.first == id) {
+            location = e.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CompactLocationMap::find(const id_type id,
+                              osmium::Location &location) const
+{
+    // Entries set later win
+    const auto u = std::lower_bound(m_unsorted.begin(), m_unsorted.end(),
+                                    entry{id, osmium::Location{}}, entry_less);
+    if (u != m_unsorted.end() && u->first == id) {
+        location = u->second;
+        return true;
+    }
+    return find_packed(id, location);
+}
+
+osmium::Location CompactLocationMap::get(const id_type id) const
+{
+    osmium::Location location;
+    if (!find(id, location)) {
+        throw osmium::not_found{id};
+    }
+    return location;
+}
+
+osmium::Location CompactLocationMap::get_noexcept(const id_type id) const
+    noexcept
+{
+    osmium::Location location;
+    find(id, location);
+    return location;
+}
+
+size_t CompactLocationMap::used_memory() const
+{
+    return sizeof(CompactLocationMap) + m_blocks.capacity() * sizeof(block) +
+           m_chunks.size() * chunk_size +
+           (m_pending.capacity() + m_unsorted.capacity()) * sizeof(entry);
+}
+
+void CompactLocationMap::clear()
+{
+    std::vector<block>().swap(m_blocks);
+    std::vector<std::unique_ptr<unsigned char[]>>().swap(m_chunks);
+    m_chunk_used = chunk_size;
+    std::vector<entry>().swap(m_pending);
+    std::vector<entry>().swap(m_unsorted);
+    m_last_id = 0;
+    m_packed_size = 0;
+    m_size = 0;
+}
+
+void CompactLocationMap::sort()
+{
+    encode_pending();
+    m_blocks.shrink_to_fit();
+
+    // Keep only the last location set for each ID, which stable_sort()
+    // leaves last among equal IDs
+    std::stable_sort(m_unsorted.begin(), m_unsorted.end(), entry_less);
+    auto out = m_unsorted.begin();
+    for (auto it = m_unsorted.begin(); it != m_unsorted.end(); ++it) {
+        if (it + 1 == m_unsorted.end() || (it + 1)->first != it->first) {
+            *out++ = *it;
+        }
+    }
+    m_unsorted.erase(out, m_unsorted.end());
+    m_unsorted.shrink_to_fit();
+
+    m_size = m_packed_size;
+    osmium::Location packed;
+    for (const auto &e : m_unsorted) {
+        if (!find_packed(e.first, packed)) {
+            ++m_size;
+        }
+    }
+}
+
+template <typename TFunc>
+void CompactLocationMap::for_each_block_entry(TFunc &&func) const
+{
+    for (const block &b : m_blocks) {
+        id_type id = b.first_id;
+        int64_t x = b.x;
+        int64_t y = b.y;
+        const unsigned char *in =
+            m_chunks[b.offset / chunk_size].get() + b.offset % chunk_size;
+        const size_t count = *in++;
+        func(entry{id, osmium::Location{static_cast<int32_t>(x),
+                                        static_cast<int32_t>(y)}});
+        for (size_t i = 1; i < count; ++i) {
+            read_entry(in, id, x, y);
+            func(entry{id, osmium::Location{static_cast<int32_t>(x),
+                                            static_cast<int32_t>(y)}});
+        }
+    }
+}
+
+void CompactLocationMap::dump_as_list(const int fd)
+{
+    sort();
+
+    std::vector<entry> buffer;
+    const auto flush = [&]() {
+        const char *data = reinterpret_cast<const char *>(buffer.data());
+        size_t left = buffer.size() * sizeof(entry);
+        while (left > 0) {
+            const long written =
+                ::write(fd, data, static_cast<unsigned int>(left));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category(),
+                                        "Write failed"};
+            }
+            data += written;
+            left -= static_cast<size_t>(written);
+        }
+        buffer.clear();
+    };
+
+    // Merge the blocks with the entries that were set out of order, which
+    // replace block entries with the same ID
+    auto u = m_unsorted.begin();
+    for_each_block_entry([&](const entry &e) {
+        for (; u != m_unsorted.end() && u->first < e.first; ++u) {
+            buffer.push_back(*u);
+        }
+        if (u == m_unsorted.end() || u->first != e.first) {
+            buffer.push_back(e);
+        }
+        if (buffer.size() >= 64 * 1024) {
+            flush();
+        }
+    });
+    buffer.insert(buffer.end(), u, m_unsorted.end());
+    flush();
+}
@@ -0,0 +1,119 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <stdexcept>
+
+#include <zlib.h>
+
+#ifdef OSMBORDER_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.hpp"
+
+namespace {
+
+bool ends_with(const std::string &text, const std::string &suffix)
+{
+    return text.size() >= suffix.size() &&
+           text.compare(text.size() - suffix.size(), suffix.size(),
+                        suffix) == 0;
+}
+
+std::string gzip(const std::string &data)
+{
+    z_stream stream{};
+    // 16 added to the window bits selects the gzip wrapper
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error{"Can't initialize gzip compression"};
+    }
+    std::string out(deflateBound(&stream, data.size()), '\0');
+    stream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+    const int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error{"gzip compression failed"};
+    }
+    out.resize(stream.total_out);
+    return out;
+}
+
+std::string zstd(const std::string &data)
+{
+#ifdef OSMBORDER_HAVE_ZSTD
+    std::string out(ZSTD_compressBound(data.size()), '\0');
+    const size_t size =
+        ZSTD_compress(&out[0], out.size(), data.data(), data.size(), 3);
+    if (ZSTD_isError(size)) {
+        throw std::runtime_error{std::string{"zstd compression failed: "} +
+                                 ZSTD_getErrorName(size)};
+    }
+    out.resize(size);
+    return out;
+#else
+    (void)data;
+    throw std::runtime_error{
+        "osmborder was built without zstd, .zst files can't be written"};
+#endif
+}
+
+} // anonymous namespace
+
+compression compression_for(const std::string &filename)
+{
+    if (ends_with(filename, ".gz")) {
+        return compression::gzip;
+    }
+    if (ends_with(filename, ".zst")) {
+        return compression::zstd;
+    }
+    return compression::none;
+}
+
+bool compression_available(compression type)
+{
+#ifndef OSMBORDER_HAVE_ZSTD
+    if (type == compression::zstd) {
+        return false;
+    }
+#endif
+    (void)type;
+    return true;
+}
+
+std::string compress(const std::string &data, compression type)
+{
+    switch (type) {
+    case compression::gzip:
+        return gzip(data);
+    case compression::zstd:
+        return zstd(data);
+    case compression::none:
+        break;
+    }
+    return data;
+}
@@ -0,0 +1,48 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string>
+
+/// How an output file is compressed
+enum class compression
+{
+    none,
+    gzip,
+    zstd
+};
+
+/// Compression for a file name: .gz is gzip, .zst zstd, anything else none.
+compression compression_for(const std::string &filename);
+
+/// Was this built with support for the compression?
+bool compression_available(compression type);
+
+/**
+ * Compress data into one complete gzip member or zstd frame. Members and
+ * frames can be concatenated into a single valid file, so blocks can be
+ * compressed independently. Throws std::runtime_error if compression fails
+ * or this was built without zstd.
+ */
+std::string compress(const std::string &data, compression type);
+
+#endif // COMPRESS_HPP
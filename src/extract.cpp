@@ -0,0 +1,383 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+#include <osmium/geom/mercator_projection.hpp>
+
+#include "extract.hpp"
+
+namespace {
+
+// Web mercator stops here
+const double max_lat = 85.0511287798066;
+
+// Upper limit for the number of strips of an edge_index
+const size_t max_strips = 4096;
+
+osmium::geom::Coordinates to_mercator(const osmium::geom::Coordinates &c)
+{
+    const double lat = std::max(-max_lat, std::min(c.y, max_lat));
+    return osmium::geom::Coordinates{osmium::geom::detail::lon_to_x(c.x),
+                                     osmium::geom::detail::lat_to_y(lat)};
+}
+
+osmium::geom::Coordinates point_on(const osmium::geom::Coordinates &a,
+                                   const osmium::geom::Coordinates &b,
+                                   double t)
+{
+    return osmium::geom::Coordinates{a.x + t * (b.x - a.x),
+                                     a.y + t * (b.y - a.y)};
+}
+
+/// Remove spaces and tabs at both ends.
+std::string trim(const std::string &text)
+{
+    const auto begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    const auto end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+} // anonymous namespace
+
+size_t ExtractArea::edge_index::strip(double y) const
+{
+    const double index = std::floor((y - m_min_y) / m_strip_height);
+    if (index < 0.0) {
+        return 0;
+    }
+    if (index >= static_cast<double>(m_strips.size())) {
+        return m_strips.size() - 1;
+    }
+    return static_cast<size_t>(index);
+}
+
+void ExtractArea::edge_index::add_ring(
+    const std::vector<osmium::geom::Coordinates> &ring)
+{
+    for (size_t i = 0; i < ring.size(); ++i) {
+        const auto &a = ring[i];
+        const auto &b = ring[(i + 1) % ring.size()];
+        if (a.x == b.x && a.y == b.y) {
+            continue;
+        }
+        if (m_edges.empty()) {
+            m_min_x = m_max_x = a.x;
+            m_min_y = m_max_y = a.y;
+        }
+        m_min_x = std::min(m_min_x, std::min(a.x, b.x));
+        m_min_y = std::min(m_min_y, std::min(a.y, b.y));
+        m_max_x = std::max(m_max_x, std::max(a.x, b.x));
+        m_max_y = std::max(m_max_y, std::max(a.y, b.y));
+        m_edges.push_back(edge{a.x, a.y, b.x, b.y});
+    }
+}
+
+void ExtractArea::edge_index::prepare()
+{
+    const size_t num_strips =
+        std::max<size_t>(1, std::min(m_edges.size() / 2, max_strips));
+    m_strips.assign(num_strips, std::vector<size_t>());
+    m_strip_height = (m_max_y - m_min_y) / num_strips;
+    if (!(m_strip_height > 0.0)) {
+        m_strip_height = 1.0;
+    }
+    for (size_t i = 0; i < m_edges.size(); ++i) {
+        const edge &e = m_edges[i];
+        const size_t last = strip(std::max(e.y1, e.y2));
+        for (size_t s = strip(std::min(e.y1, e.y2)); s <= last; ++s) {
+            m_strips[s].push_back(i);
+        }
+    }
+}
+
+bool ExtractArea::edge_index::contains(double x, double y) const
+{
+    if (x < m_min_x || x > m_max_x || y < m_min_y || y > m_max_y) {
+        return false;
+    }
+    bool inside = false;
+    for (const size_t i : m_strips[strip(y)]) {
+        const edge &e = m_edges[i];
+        if ((e.y1 > y) != (e.y2 > y)) {
+            const double cross_x =
+                e.x1 + (y - e.y1) * (e.x2 - e.x1) / (e.y2 - e.y1);
+            if (x < cross_x) {
+                inside = !inside;
+            }
+        }
+    }
+    return inside;
+}
+
+bool ExtractArea::edge_index::near(double x, double y, double distance) const
+{
+    if (x < m_min_x - distance || x > m_max_x + distance ||
+        y < m_min_y - distance || y > m_max_y + distance) {
+        return false;
+    }
+    const double distance2 = distance * distance;
+    const size_t last = strip(y + distance);
+    for (size_t s = strip(y - distance); s <= last; ++s) {
+        for (const size_t i : m_strips[s]) {
+            const edge &e = m_edges[i];
+            if (x < std::min(e.x1, e.x2) - distance ||
+                x > std::max(e.x1, e.x2) + distance ||
+                y < std::min(e.y1, e.y2) - distance ||
+                y > std::max(e.y1, e.y2) + distance) {
+                continue;
+            }
+            // Distance to the closest point of the edge
+            const double dx = e.x2 - e.x1;
+            const double dy = e.y2 - e.y1;
+            double t = ((x - e.x1) * dx + (y - e.y1) * dy) /
+                       (dx * dx + dy * dy);
+            t = std::max(0.0, std::min(t, 1.0));
+            const double px = e.x1 + t * dx - x;
+            const double py = e.y1 + t * dy - y;
+            if (px * px + py * py <= distance2) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ExtractArea::edge_index::crossings(const osmium::geom::Coordinates &a,
+                                        const osmium::geom::Coordinates &b,
+                                        std::vector<double> &ts) const
+{
+    // Edges can be in several strips, each is only tested once
+    std::vector<size_t> candidates;
+    const size_t last = strip(std::max(a.y, b.y));
+    for (size_t s = strip(std::min(a.y, b.y)); s <= last; ++s) {
+        candidates.insert(candidates.end(), m_strips[s].begin(),
+                          m_strips[s].end());
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+
+    const double dx = b.x - a.x;
+    const double dy = b.y - a.y;
+    for (const size_t i : candidates) {
+        const edge &e = m_edges[i];
+        const double ex = e.x2 - e.x1;
+        const double ey = e.y2 - e.y1;
+        const double denominator = dx * ey - dy * ex;
+        if (denominator == 0.0) {
+            // Parallel, touching doesn't change the side
+            continue;
+        }
+        const double fx = e.x1 - a.x;
+        const double fy = e.y1 - a.y;
+        const double t = (fx * ey - fy * ex) / denominator;
+        const double u = (fx * dy - fy * dx) / denominator;
+        if (t >= 0.0 && t <= 1.0 && u >= 0.0 && u <= 1.0) {
+            ts.push_back(t);
+        }
+    }
+}
+
+bool ExtractArea::edge_index::overlaps(const osmium::geom::Coordinates &a,
+                                       const osmium::geom::Coordinates &b) const
+{
+    return std::max(a.x, b.x) >= m_min_x && std::min(a.x, b.x) <= m_max_x &&
+           std::max(a.y, b.y) >= m_min_y && std::min(a.y, b.y) <= m_max_y;
+}
+
+ExtractArea::ExtractArea(double min_lon, double min_lat, double max_lon,
+                         double max_lat, double buffer)
+: m_buffer(buffer)
+{
+    add_ring({osmium::geom::Coordinates{min_lon, min_lat},
+              osmium::geom::Coordinates{max_lon, min_lat},
+              osmium::geom::Coordinates{max_lon, max_lat},
+              osmium::geom::Coordinates{min_lon, max_lat}});
+    prepare();
+}
+
+ExtractArea::ExtractArea(const std::string &poly_file, double buffer)
+: m_buffer(buffer)
+{
+    std::ifstream in{poly_file};
+    if (!in) {
+        throw std::runtime_error{"Can't open polygon file '" + poly_file +
+                                 "'"};
+    }
+
+    int line_number = 0;
+    std::string line;
+    const auto next_line = [&]() {
+        for (;;) {
+            if (!std::getline(in, line)) {
+                throw std::runtime_error{"Polygon file '" + poly_file +
+                                         "' ends without END"};
+            }
+            ++line_number;
+            line = trim(line);
+            if (!line.empty()) {
+                return;
+            }
+        }
+    };
+
+    // The first line is the name of the polygon
+    next_line();
+
+    bool have_ring = false;
+    std::vector<osmium::geom::Coordinates> ring;
+    for (;;) {
+        // Either the END of the file or the name of a ring, which starts
+        // with ! for holes
+        next_line();
+        if (line == "END") {
+            break;
+        }
+        ring.clear();
+        for (next_line(); line != "END"; next_line()) {
+            const char *text = line.c_str();
+            char *end = nullptr;
+            const double lon = std::strtod(text, &end);
+            const char *lat_text = end;
+            const double lat = std::strtod(lat_text, &end);
+            if (end == text || end == lat_text || !trim(end).empty()) {
+                throw std::runtime_error{poly_file + ":" +
+                                         std::to_string(line_number) +
+                                         ": expected a longitude and "
+                                         "latitude"};
+            }
+            ring.emplace_back(lon, lat);
+        }
+        if (ring.size() < 3) {
+            throw std::runtime_error{poly_file + ":" +
+                                     std::to_string(line_number) +
+                                     ": ring with fewer than three points"};
+        }
+        add_ring(ring);
+        have_ring = true;
+    }
+    if (!have_ring) {
+        throw std::runtime_error{"Polygon file '" + poly_file +
+                                 "' has no rings"};
+    }
+    prepare();
+}
+
+void ExtractArea::add_ring(const std::vector<osmium::geom::Coordinates> &ring)
+{
+    m_geographic.add_ring(ring);
+    std::vector<osmium::geom::Coordinates> projected;
+    projected.reserve(ring.size());
+    for (const auto &c : ring) {
+        projected.push_back(to_mercator(c));
+    }
+    m_mercator.add_ring(projected);
+}
+
+void ExtractArea::prepare()
+{
+    m_geographic.prepare();
+    m_mercator.prepare();
+}
+
+bool ExtractArea::keep(const osmium::Location &location) const
+{
+    if (!location.valid()) {
+        return false;
+    }
+    const double lon = location.lon_without_check();
+    const double lat = location.lat_without_check();
+    return m_geographic.contains(lon, lat) ||
+           (m_buffer > 0.0 && m_geographic.near(lon, lat, m_buffer));
+}
+
+bool ExtractArea::intersects(
+    const std::vector<osmium::geom::Coordinates> &line) const
+{
+    for (const auto &c : line) {
+        if (m_mercator.contains(c.x, c.y)) {
+            return true;
+        }
+    }
+    std::vector<double> ts;
+    for (size_t i = 1; i < line.size(); ++i) {
+        if (m_mercator.overlaps(line[i - 1], line[i])) {
+            m_mercator.crossings(line[i - 1], line[i], ts);
+            if (!ts.empty()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ExtractArea::clip(
+    const std::vector<osmium::geom::Coordinates> &line,
+    std::vector<std::vector<osmium::geom::Coordinates>> &parts) const
+{
+    parts.clear();
+    // Is the line still inside at the end of the last part?
+    bool inside = false;
+    std::vector<double> ts;
+    for (size_t i = 1; i < line.size(); ++i) {
+        const auto &a = line[i - 1];
+        const auto &b = line[i];
+        ts.assign(1, 0.0);
+        if (m_mercator.overlaps(a, b)) {
+            m_mercator.crossings(a, b, ts);
+        }
+        ts.push_back(1.0);
+        std::sort(ts.begin(), ts.end());
+
+        // Between two crossings the segment is either all in or all out
+        for (size_t k = 1; k < ts.size(); ++k) {
+            if (!(ts[k] > ts[k - 1])) {
+                continue;
+            }
+            const auto middle = point_on(a, b, (ts[k - 1] + ts[k]) / 2);
+            if (!m_mercator.contains(middle.x, middle.y)) {
+                inside = false;
+                continue;
+            }
+            if (!inside) {
+                parts.emplace_back();
+                parts.back().push_back(point_on(a, b, ts[k - 1]));
+            }
+            parts.back().push_back(point_on(a, b, ts[k]));
+            inside = true;
+        }
+    }
+    parts.erase(std::remove_if(
+                    parts.begin(), parts.end(),
+                    [](const std::vector<osmium::geom::Coordinates> &part) {
+                        return part.size() < 2;
+                    }),
+                parts.end());
+}
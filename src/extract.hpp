@@ -0,0 +1,123 @@
+#ifndef EXTRACT_HPP
+#define EXTRACT_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string>
+#include <vector>
+
+#include <osmium/geom/coordinates.hpp>
+#include <osmium/osm/location.hpp>
+
+/**
+ * The area of a regional extract: a bounding box, or the polygons of an
+ * Osmosis polygon file. Nodes are kept if they are in the area or within a
+ * buffer around it. Lines, which are in web mercator, can be tested against
+ * the area or clipped to it.
+ *
+ * Polygons are tested with the even-odd rule, so holes in a polygon file
+ * work as long as they are inside an outer ring. The edges are sorted into
+ * horizontal strips, so a test only looks at the edges near the point.
+ */
+class ExtractArea
+{
+public:
+    /// Box in WGS84, with a buffer in degrees.
+    ExtractArea(double min_lon, double min_lat, double max_lon,
+                double max_lat, double buffer);
+
+    /**
+     * Read the area from an Osmosis polygon file, with a buffer in
+     * degrees. Throws std::runtime_error if it can't be read or isn't a
+     * polygon file.
+     */
+    ExtractArea(const std::string &poly_file, double buffer);
+
+    /// Is the location in the area or its buffer?
+    bool keep(const osmium::Location &location) const;
+
+    /// Does a line in web mercator touch the area?
+    bool intersects(const std::vector<osmium::geom::Coordinates> &line) const;
+
+    /**
+     * Clip a line in web mercator to the area. Each time the line leaves
+     * the area a new part starts.
+     */
+    void clip(const std::vector<osmium::geom::Coordinates> &line,
+              std::vector<std::vector<osmium::geom::Coordinates>> &parts) const;
+
+private:
+    // Edges of rings in one coordinate system, sorted into strips by y
+    class edge_index
+    {
+        struct edge
+        {
+            double x1;
+            double y1;
+            double x2;
+            double y2;
+        };
+
+        std::vector<edge> m_edges;
+        // Indexes into m_edges for each strip, for edges that reach it
+        std::vector<std::vector<size_t>> m_strips;
+        double m_min_x = 0.0;
+        double m_min_y = 0.0;
+        double m_max_x = 0.0;
+        double m_max_y = 0.0;
+        double m_strip_height = 1.0;
+
+        size_t strip(double y) const;
+
+    public:
+        void add_ring(const std::vector<osmium::geom::Coordinates> &ring);
+
+        /// Build the strips, after the last add_ring().
+        void prepare();
+
+        bool contains(double x, double y) const;
+
+        /// Is an edge at most distance from the point?
+        bool near(double x, double y, double distance) const;
+
+        /**
+         * Add the parameters along the segment from a to b where it
+         * crosses an edge to ts.
+         */
+        void crossings(const osmium::geom::Coordinates &a,
+                       const osmium::geom::Coordinates &b,
+                       std::vector<double> &ts) const;
+
+        /// Could the segment from a to b touch the area at all?
+        bool overlaps(const osmium::geom::Coordinates &a,
+                      const osmium::geom::Coordinates &b) const;
+    };
+
+    void add_ring(const std::vector<osmium::geom::Coordinates> &ring);
+    void prepare();
+
+    // In WGS84 for the nodes and web mercator for the lines
+    edge_index m_geographic;
+    edge_index m_mercator;
+    double m_buffer;
+};
+
+#endif // EXTRACT_HPP
@@ -0,0 +1,634 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "flatgeobuf.hpp"
+
+namespace {
+
+/* ================================================== */
+/* Little endian encoding                             */
+/* ================================================== */
+
+void put_uint(std::string &buf, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        buf += static_cast<char>(value >> (8 * i));
+    }
+}
+
+void patch_uint(std::string &buf, size_t pos, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        buf[pos + i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+uint64_t double_bits(double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+void put_double(std::string &buf, double value)
+{
+    put_uint(buf, double_bits(value), 8);
+}
+
+void pad_to(std::string &buf, size_t alignment)
+{
+    while (buf.size() % alignment) {
+        buf += '\0';
+    }
+}
+
+/* ================================================== */
+/* Minimal FlatBuffers encoder                        */
+/* ================================================== */
+
+/*
+ * FlatBuffers are normally built back to front. Here objects are written
+ * front to back instead: each table is written with its vtable just before
+ * it and its children after it, so all uoffsets point forward as required.
+ * Alignment is relative to the start of the buffer, which includes the
+ * size prefix, matching FinishSizePrefixed() in the FlatBuffers library.
+ */
+
+class fb_object
+{
+public:
+    virtual ~fb_object() = default;
+    /// Append the object and return the position an offset to it points at
+    virtual size_t write(std::string &buf) const = 0;
+};
+
+typedef std::unique_ptr<fb_object> fb_ptr;
+
+class fb_string : public fb_object
+{
+    std::string m_value;
+
+public:
+    explicit fb_string(std::string value) : m_value(std::move(value)) {}
+
+    size_t write(std::string &buf) const override
+    {
+        pad_to(buf, 4);
+        const size_t pos = buf.size();
+        put_uint(buf, m_value.size(), 4);
+        buf += m_value;
+        buf += '\0';
+        return pos;
+    }
+};
+
+/// Vector of scalars, given as little endian bytes
+class fb_scalar_vector : public fb_object
+{
+    std::string m_data;
+    size_t m_element_size;
+
+public:
+    fb_scalar_vector(std::string data, size_t element_size)
+    : m_data(std::move(data)), m_element_size(element_size)
+    {
+    }
+
+    size_t write(std::string &buf) const override
+    {
+        // The elements need to be aligned, not the length in front of them
+        const size_t alignment = std::max<size_t>(m_element_size, 4);
+        while ((buf.size() + 4) % alignment) {
+            buf += '\0';
+        }
+        const size_t pos = buf.size();
+        put_uint(buf, m_data.size() / m_element_size, 4);
+        buf += m_data;
+        return pos;
+    }
+};
+
+class fb_table : public fb_object
+{
+    struct field
+    {
+        uint16_t id;
+        size_t size;
+        uint64_t value;
+        fb_ptr child;
+    };
+
+    std::vector<field> m_fields;
+
+public:
+    void add_scalar(uint16_t id, uint64_t value, size_t size)
+    {
+        m_fields.push_back(field{id, size, value, nullptr});
+    }
+
+    void add_child(uint16_t id, fb_ptr child)
+    {
+        m_fields.push_back(field{id, 4, 0, std::move(child)});
+    }
+
+    size_t write(std::string &buf) const override
+    {
+        // Lay out the fields largest first after the vtable offset
+        std::vector<size_t> order(m_fields.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return m_fields[a].size > m_fields[b].size;
+        });
+        std::vector<size_t> field_offset(m_fields.size());
+        size_t table_size = 4;
+        uint16_t num_slots = 0;
+        for (const size_t i : order) {
+            const size_t size = m_fields[i].size;
+            table_size = (table_size + size - 1) / size * size;
+            field_offset[i] = table_size;
+            table_size += size;
+            num_slots = std::max<uint16_t>(num_slots, m_fields[i].id + 1);
+        }
+        table_size = (table_size + 3) / 4 * 4;
+
+        pad_to(buf, 2);
+        const size_t vtable_pos = buf.size();
+        put_uint(buf, 4 + 2 * num_slots, 2);
+        put_uint(buf, table_size, 2);
+        for (uint16_t slot = 0; slot < num_slots; ++slot) {
+            size_t offset = 0;
+            for (size_t i = 0; i < m_fields.size(); ++i) {
+                if (m_fields[i].id == slot) {
+                    offset = field_offset[i];
+                }
+            }
+            put_uint(buf, offset, 2);
+        }
+
+        pad_to(buf, 8);
+        const size_t table_pos = buf.size();
+        buf.append(table_size, '\0');
+        patch_uint(buf, table_pos, table_pos - vtable_pos, 4);
+        for (size_t i = 0; i < m_fields.size(); ++i) {
+            if (!m_fields[i].child) {
+                patch_uint(buf, table_pos + field_offset[i], m_fields[i].value,
+                           m_fields[i].size);
+            }
+        }
+
+        for (size_t i = 0; i < m_fields.size(); ++i) {
+            if (m_fields[i].child) {
+                const size_t slot_pos = table_pos + field_offset[i];
+                const size_t child_pos = m_fields[i].child->write(buf);
+                patch_uint(buf, slot_pos, child_pos - slot_pos, 4);
+            }
+        }
+
+        return table_pos;
+    }
+};
+
+class fb_table_vector : public fb_object
+{
+    std::vector<std::unique_ptr<fb_table>> m_tables;
+
+public:
+    void add(std::unique_ptr<fb_table> table)
+    {
+        m_tables.push_back(std::move(table));
+    }
+
+    size_t write(std::string &buf) const override
+    {
+        pad_to(buf, 4);
+        const size_t pos = buf.size();
+        put_uint(buf, m_tables.size(), 4);
+        buf.append(4 * m_tables.size(), '\0');
+        for (size_t i = 0; i < m_tables.size(); ++i) {
+            const size_t slot_pos = pos + 4 + 4 * i;
+            const size_t table_pos = m_tables[i]->write(buf);
+            patch_uint(buf, slot_pos, table_pos - slot_pos, 4);
+        }
+        return pos;
+    }
+};
+
+/// Encode a size-prefixed buffer with the given root table
+std::string finish(const fb_table &root)
+{
+    std::string buf(8, '\0');
+    const size_t root_pos = root.write(buf);
+    patch_uint(buf, 0, buf.size() - 4, 4);
+    patch_uint(buf, 4, root_pos - 4, 4);
+    return buf;
+}
+
+/* ================================================== */
+/* FlatGeobuf schema                                  */
+/* ================================================== */
+
+const unsigned char magic_bytes[8] = {'f', 'g', 'b', 3, 'f', 'g', 'b', 0};
+
+const uint8_t geometry_type_linestring = 2;
+
+enum column_type : uint8_t
+{
+    column_bool = 2,
+    column_int = 5,
+    column_long = 7,
+    column_string = 11
+};
+
+// Header table fields
+enum
+{
+    header_name = 0,
+    header_envelope = 1,
+    header_geometry_type = 2,
+    header_columns = 7,
+    header_features_count = 8,
+    header_index_node_size = 9,
+    header_crs = 10
+};
+
+// Column table fields
+enum
+{
+    column_name = 0,
+    column_type_field = 1,
+    column_nullable = 7
+};
+
+// Crs table fields
+enum
+{
+    crs_org = 0,
+    crs_code = 1
+};
+
+// Geometry table fields
+enum
+{
+    geometry_xy = 1
+};
+
+// Feature table fields
+enum
+{
+    feature_geometry = 0,
+    feature_properties = 1
+};
+
+struct column_def
+{
+    const char *name;
+    column_type type;
+};
+
+// Order matters, the index is how properties refer to a column
+const column_def columns[] = {{"osm_id", column_long},
+                              {"admin_level", column_int},
+                              {"dividing_line", column_bool},
+                              {"disputed", column_bool},
+                              {"maritime", column_bool}};
+
+// Only there for merged lines, a comma separated list
+const column_def way_ids_column = {"way_ids", column_string};
+
+const uint16_t index_node_size = 16;
+
+std::string encode_header(uint64_t features_count, const double envelope[4],
+                          bool with_way_ids)
+{
+    fb_table header;
+    header.add_child(header_name, fb_ptr(new fb_string("osmborder_lines")));
+
+    std::string envelope_data;
+    for (int i = 0; i < 4; ++i) {
+        put_double(envelope_data, envelope[i]);
+    }
+    header.add_child(header_envelope,
+                     fb_ptr(new fb_scalar_vector(envelope_data, 8)));
+    header.add_scalar(header_geometry_type, geometry_type_linestring, 1);
+
+    std::unique_ptr<fb_table_vector> column_tables(new fb_table_vector);
+    std::vector<column_def> defs(std::begin(columns), std::end(columns));
+    if (with_way_ids) {
+        defs.push_back(way_ids_column);
+    }
+    for (const auto &def : defs) {
+        std::unique_ptr<fb_table> column(new fb_table);
+        column->add_child(column_name, fb_ptr(new fb_string(def.name)));
+        column->add_scalar(column_type_field, def.type, 1);
+        column->add_scalar(column_nullable, 0, 1);
+        column_tables->add(std::move(column));
+    }
+    header.add_child(header_columns, std::move(column_tables));
+
+    header.add_scalar(header_features_count, features_count, 8);
+    // A node size of 0 means there is no index
+    header.add_scalar(header_index_node_size,
+                      features_count > 0 ? index_node_size : 0, 2);
+
+    std::unique_ptr<fb_table> crs(new fb_table);
+    crs->add_child(crs_org, fb_ptr(new fb_string("EPSG")));
+    crs->add_scalar(crs_code, 3857, 4);
+    header.add_child(header_crs, std::move(crs));
+
+    return finish(header);
+}
+
+/* ================================================== */
+/* Packed Hilbert R-tree                              */
+/* ================================================== */
+
+// Position on a 2^16 x 2^16 Hilbert curve, same as the reference
+// implementation so files sort the same way
+uint32_t hilbert(uint32_t x, uint32_t y)
+{
+    uint32_t a = x ^ y;
+    uint32_t b = 0xFFFF ^ a;
+    uint32_t c = 0xFFFF ^ (x | y);
+    uint32_t d = x & (y ^ 0xFFFF);
+
+    uint32_t A = a | (b >> 1);
+    uint32_t B = (a >> 1) ^ a;
+    uint32_t C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+    uint32_t D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+
+    a = A;
+    b = B;
+    c = C;
+    d = D;
+    A = ((a & (a >> 2)) ^ (b & (b >> 2)));
+    B = ((a & (b >> 2)) ^ (b & ((a ^ b) >> 2)));
+    C ^= ((a & (c >> 2)) ^ (b & (d >> 2)));
+    D ^= ((b & (c >> 2)) ^ ((a ^ b) & (d >> 2)));
+
+    a = A;
+    b = B;
+    c = C;
+    d = D;
+    A = ((a & (a >> 4)) ^ (b & (b >> 4)));
+    B = ((a & (b >> 4)) ^ (b & ((a ^ b) >> 4)));
+    C ^= ((a & (c >> 4)) ^ (b & (d >> 4)));
+    D ^= ((b & (c >> 4)) ^ ((a ^ b) & (d >> 4)));
+
+    a = A;
+    b = B;
+    c = C;
+    d = D;
+    C ^= ((a & (c >> 8)) ^ (b & (d >> 8)));
+    D ^= ((b & (c >> 8)) ^ ((a ^ b) & (d >> 8)));
+
+    a = C ^ (C >> 1);
+    b = D ^ (D >> 1);
+
+    uint32_t i0 = x ^ y;
+    uint32_t i1 = b | (0xFFFF ^ (i0 | a));
+
+    i0 = (i0 | (i0 << 8)) & 0x00FF00FF;
+    i0 = (i0 | (i0 << 4)) & 0x0F0F0F0F;
+    i0 = (i0 | (i0 << 2)) & 0x33333333;
+    i0 = (i0 | (i0 << 1)) & 0x55555555;
+
+    i1 = (i1 | (i1 << 8)) & 0x00FF00FF;
+    i1 = (i1 | (i1 << 4)) & 0x0F0F0F0F;
+    i1 = (i1 | (i1 << 2)) & 0x33333333;
+    i1 = (i1 | (i1 << 1)) & 0x55555555;
+
+    return (i1 << 1) | i0;
+}
+
+struct node_item
+{
+    double min_x = std::numeric_limits<double>::infinity();
+    double min_y = std::numeric_limits<double>::infinity();
+    double max_x = -std::numeric_limits<double>::infinity();
+    double max_y = -std::numeric_limits<double>::infinity();
+    uint64_t offset = 0;
+
+    void expand(const node_item &other)
+    {
+        min_x = std::min(min_x, other.min_x);
+        min_y = std::min(min_y, other.min_y);
+        max_x = std::max(max_x, other.max_x);
+        max_y = std::max(max_y, other.max_y);
+    }
+};
+
+/**
+ * Build the packed tree from the leaves, which must already be in Hilbert
+ * order. Levels are stored root first, and the offset of an inner node is
+ * the index of its first child.
+ */
+std::vector<node_item> build_index(const std::vector<node_item> &leaves)
+{
+    // Nodes per level, leaves first
+    std::vector<uint64_t> level_nodes;
+    uint64_t n = leaves.size();
+    uint64_t num_nodes = n;
+    level_nodes.push_back(n);
+    do {
+        n = (n + index_node_size - 1) / index_node_size;
+        num_nodes += n;
+        level_nodes.push_back(n);
+    } while (n != 1);
+
+    std::vector<uint64_t> level_start;
+    n = num_nodes;
+    for (const auto size : level_nodes) {
+        n -= size;
+        level_start.push_back(n);
+    }
+
+    std::vector<node_item> nodes(num_nodes);
+    std::copy(leaves.begin(), leaves.end(), nodes.begin() + level_start[0]);
+
+    for (size_t level = 0; level + 1 < level_nodes.size(); ++level) {
+        uint64_t pos = level_start[level];
+        const uint64_t end = pos + level_nodes[level];
+        uint64_t parent = level_start[level + 1];
+        while (pos < end) {
+            node_item node;
+            node.offset = pos;
+            for (uint16_t i = 0; i < index_node_size && pos < end; ++i) {
+                node.expand(nodes[pos++]);
+            }
+            nodes[parent++] = node;
+        }
+    }
+
+    return nodes;
+}
+
+} // anonymous namespace
+
+namespace flatgeobuf {
+
+feature encode_feature(const BorderLine &line)
+{
+    feature f;
+    f.min_x = f.min_y = std::numeric_limits<double>::infinity();
+    f.max_x = f.max_y = -std::numeric_limits<double>::infinity();
+
+    std::string xy;
+    xy.reserve(16 * line.coordinates.size());
+    for (const auto &c : line.coordinates) {
+        put_double(xy, c.x);
+        put_double(xy, c.y);
+        f.min_x = std::min(f.min_x, c.x);
+        f.min_y = std::min(f.min_y, c.y);
+        f.max_x = std::max(f.max_x, c.x);
+        f.max_y = std::max(f.max_y, c.y);
+    }
+
+    // Properties are the column index followed by the value
+    std::string properties;
+    put_uint(properties, 0, 2);
+    put_uint(properties, static_cast<uint64_t>(line.id), 8);
+    put_uint(properties, 1, 2);
+    put_uint(properties, static_cast<uint32_t>(line.admin_level), 4);
+    put_uint(properties, 2, 2);
+    put_uint(properties, line.dividing_line, 1);
+    put_uint(properties, 3, 2);
+    put_uint(properties, line.disputed, 1);
+    put_uint(properties, 4, 2);
+    put_uint(properties, line.maritime, 1);
+    if (!line.way_ids.empty()) {
+        std::string ids;
+        for (const auto id : line.way_ids) {
+            if (!ids.empty()) {
+                ids += ',';
+            }
+            append_int(ids, id);
+        }
+        put_uint(properties, sizeof(columns) / sizeof(columns[0]), 2);
+        put_uint(properties, ids.size(), 4);
+        properties += ids;
+    }
+
+    std::unique_ptr<fb_table> geometry(new fb_table);
+    geometry->add_child(geometry_xy,
+                        fb_ptr(new fb_scalar_vector(std::move(xy), 8)));
+
+    fb_table root;
+    root.add_child(feature_geometry, std::move(geometry));
+    root.add_child(feature_properties,
+                   fb_ptr(new fb_scalar_vector(std::move(properties), 1)));
+    f.data = finish(root);
+
+    return f;
+}
+
+void write_file(OutputWriter &out, std::vector<feature> &features,
+                bool with_way_ids)
+{
+    double envelope[4] = {std::numeric_limits<double>::infinity(),
+                          std::numeric_limits<double>::infinity(),
+                          -std::numeric_limits<double>::infinity(),
+                          -std::numeric_limits<double>::infinity()};
+    for (const auto &f : features) {
+        envelope[0] = std::min(envelope[0], f.min_x);
+        envelope[1] = std::min(envelope[1], f.min_y);
+        envelope[2] = std::max(envelope[2], f.max_x);
+        envelope[3] = std::max(envelope[3], f.max_y);
+    }
+
+    out.write(std::string(reinterpret_cast<const char *>(magic_bytes),
+                          sizeof(magic_bytes)));
+
+    if (features.empty()) {
+        const double empty[4] = {0, 0, 0, 0};
+        out.write(encode_header(0, empty, with_way_ids));
+        return;
+    }
+
+    // Sort by the Hilbert value of the bbox centre. A stable sort keeps
+    // the output the same from run to run.
+    const uint32_t hilbert_max = (1u << 16) - 1;
+    const double width = envelope[2] - envelope[0];
+    const double height = envelope[3] - envelope[1];
+    std::vector<std::pair<uint32_t, size_t>> order;
+    order.reserve(features.size());
+    for (size_t i = 0; i < features.size(); ++i) {
+        const auto &f = features[i];
+        uint32_t x = 0;
+        uint32_t y = 0;
+        if (width != 0.0) {
+            x = static_cast<uint32_t>(std::floor(
+                hilbert_max * ((f.min_x + f.max_x) / 2 - envelope[0]) / width));
+        }
+        if (height != 0.0) {
+            y = static_cast<uint32_t>(std::floor(
+                hilbert_max * ((f.min_y + f.max_y) / 2 - envelope[1]) /
+                height));
+        }
+        order.emplace_back(hilbert(x, y), i);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const std::pair<uint32_t, size_t> &a,
+                        const std::pair<uint32_t, size_t> &b) {
+                         return a.first > b.first;
+                     });
+
+    std::vector<node_item> leaves(features.size());
+    uint64_t offset = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const auto &f = features[order[i].second];
+        leaves[i].min_x = f.min_x;
+        leaves[i].min_y = f.min_y;
+        leaves[i].max_x = f.max_x;
+        leaves[i].max_y = f.max_y;
+        leaves[i].offset = offset;
+        offset += f.data.size();
+    }
+
+    out.write(encode_header(features.size(), envelope, with_way_ids));
+
+    std::string index;
+    for (const auto &node : build_index(leaves)) {
+        put_double(index, node.min_x);
+        put_double(index, node.min_y);
+        put_double(index, node.max_x);
+        put_double(index, node.max_y);
+        put_uint(index, node.offset, 8);
+    }
+    out.write(std::move(index));
+
+    for (const auto &entry : order) {
+        out.write(std::move(features[entry.second].data));
+    }
+}
+
+} // namespace flatgeobuf
@@ -0,0 +1,66 @@
+#ifndef FLATGEOBUF_HPP
+#define FLATGEOBUF_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <string>
+#include <vector>
+
+#include "borderline.hpp"
+#include "output.hpp"
+
+/**
+ * Writer for FlatGeobuf files (https://flatgeobuf.org/) with a packed
+ * Hilbert R-tree index. The schema is fixed to the osmborder columns, so the
+ * FlatBuffers tables are encoded directly instead of depending on the
+ * FlatBuffers library.
+ */
+namespace flatgeobuf {
+
+/// An encoded feature along with its bounding box
+struct feature
+{
+    double min_x;
+    double min_y;
+    double max_x;
+    double max_y;
+    /// Size-prefixed Feature table, as it appears in the file
+    std::string data;
+};
+
+/**
+ * Encode a border line as a feature. This is independent of the other
+ * features, so it can run on any thread. The way IDs of merged lines are
+ * written to an extra column.
+ */
+feature encode_feature(const BorderLine &line);
+
+/**
+ * Write a complete file with the header, spatial index and features.
+ * The features are sorted along a Hilbert curve in the process. If
+ * with_way_ids is set, the header has the column for merged lines.
+ */
+void write_file(OutputWriter &out, std::vector<feature> &features,
+                bool with_way_ids);
+
+} // namespace flatgeobuf
+
+#endif // FLATGEOBUF_HPP
@@ -0,0 +1,267 @@
+#ifndef IDSET_HPP
+#define IDSET_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+/**
+ * Set of OSM object IDs, used for the ways and nodes we want to keep.
+ *
+ * IDs are split into chunks of 2^16. Like a roaring bitmap, each chunk
+ * starts as a sorted array of the low 16 bits of its IDs and turns into a
+ * plain bitmap once that would be smaller. Lookups are an array index plus
+ * either a bit test or a short binary search, and IDs can be added in any
+ * order. Negative IDs are kept separately by their absolute value. The
+ * chunk list is a plain vector indexed by the high bits, which covers
+ * everything up to 2^40. Chunks for IDs beyond that, which don't occur in
+ * OSM data, go into a map so a stray huge ID can't blow up the vector.
+ *
+ * Adding IDs is not thread safe, but once the set is filled any number of
+ * threads can call get() at the same time.
+ */
+class IdSet
+{
+    static constexpr int chunk_bits = 16;
+    static constexpr uint64_t chunk_mask = (1u << chunk_bits) - 1;
+    // Bitmap for a chunk, in 64 bit words
+    static constexpr size_t bitmap_words = (1u << chunk_bits) / 64;
+    // An array with more entries than this is bigger than the bitmap
+    static constexpr size_t max_array_size = bitmap_words * 4;
+    // Chunks with an index from here on are kept in the overflow map
+    static constexpr uint64_t max_direct_chunks = uint64_t(1) << 24;
+
+    class chunk
+    {
+        // Sorted low bits of the IDs, until it turns into a bitmap
+        std::vector<uint16_t> m_array;
+        std::vector<uint64_t> m_bitmap;
+
+    public:
+        /// Returns true if the value wasn't in the chunk yet
+        bool set(uint16_t value)
+        {
+            if (!m_bitmap.empty()) {
+                uint64_t &word = m_bitmap[value >> 6];
+                const uint64_t bit = uint64_t(1) << (value & 63);
+                const bool added = !(word & bit);
+                word |= bit;
+                return added;
+            }
+
+            const auto it =
+                std::lower_bound(m_array.begin(), m_array.end(), value);
+            if (it != m_array.end() && *it == value) {
+                return false;
+            }
+            m_array.insert(it, value);
+
+            if (m_array.size() > max_array_size) {
+                m_bitmap.assign(bitmap_words, 0);
+                for (const uint16_t v : m_array) {
+                    m_bitmap[v >> 6] |= uint64_t(1) << (v & 63);
+                }
+                std::vector<uint16_t>().swap(m_array);
+            }
+            return true;
+        }
+
+        bool get(uint16_t value) const
+        {
+            if (!m_bitmap.empty()) {
+                return (m_bitmap[value >> 6] >> (value & 63)) & 1;
+            }
+            return std::binary_search(m_array.begin(), m_array.end(), value);
+        }
+
+        bool any_in(uint16_t first, uint16_t last) const
+        {
+            if (!m_bitmap.empty()) {
+                for (uint32_t v = first; v <= last; ++v) {
+                    if ((v & 63) == 0 && v + 63 <= last) {
+                        if (m_bitmap[v >> 6]) {
+                            return true;
+                        }
+                        v += 63;
+                    } else if ((m_bitmap[v >> 6] >> (v & 63)) & 1) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            const auto it =
+                std::lower_bound(m_array.begin(), m_array.end(), first);
+            return it != m_array.end() && *it <= last;
+        }
+
+        size_t used_memory() const
+        {
+            return sizeof(chunk) + m_array.capacity() * sizeof(uint16_t) +
+                   m_bitmap.capacity() * sizeof(uint64_t);
+        }
+    };
+
+    struct chunk_list
+    {
+        std::vector<std::unique_ptr<chunk>> direct;
+        std::map<uint64_t, chunk> overflow;
+    };
+
+    chunk_list m_positive;
+    chunk_list m_negative;
+    size_t m_size = 0;
+
+    static bool set_in(chunk_list &chunks, uint64_t id)
+    {
+        const uint64_t index = id >> chunk_bits;
+        const uint16_t value = static_cast<uint16_t>(id & chunk_mask);
+        if (index >= max_direct_chunks) {
+            return chunks.overflow[index].set(value);
+        }
+        if (index >= chunks.direct.size()) {
+            chunks.direct.resize(index + 1);
+        }
+        if (!chunks.direct[index]) {
+            chunks.direct[index].reset(new chunk);
+        }
+        return chunks.direct[index]->set(value);
+    }
+
+    static bool get_in(const chunk_list &chunks, uint64_t id)
+    {
+        const uint64_t index = id >> chunk_bits;
+        const uint16_t value = static_cast<uint16_t>(id & chunk_mask);
+        if (index >= max_direct_chunks) {
+            const auto it = chunks.overflow.find(index);
+            return it != chunks.overflow.end() && it->second.get(value);
+        }
+        if (index >= chunks.direct.size() || !chunks.direct[index]) {
+            return false;
+        }
+        return chunks.direct[index]->get(value);
+    }
+
+    static bool any_in_list(const chunk_list &chunks, uint64_t first,
+                            uint64_t last)
+    {
+        const uint64_t first_index = first >> chunk_bits;
+        const uint64_t last_index = last >> chunk_bits;
+        const auto range = [&](uint64_t index, const chunk &c) {
+            const uint16_t from = index == first_index
+                                      ? static_cast<uint16_t>(first & chunk_mask)
+                                      : 0;
+            const uint16_t to = index == last_index
+                                    ? static_cast<uint16_t>(last & chunk_mask)
+                                    : static_cast<uint16_t>(chunk_mask);
+            return c.any_in(from, to);
+        };
+
+        const uint64_t direct_end = std::min<uint64_t>(
+            last_index + 1, static_cast<uint64_t>(chunks.direct.size()));
+        for (uint64_t index = first_index; index < direct_end; ++index) {
+            if (chunks.direct[index] && range(index, *chunks.direct[index])) {
+                return true;
+            }
+        }
+        for (auto it = chunks.overflow.lower_bound(first_index);
+             it != chunks.overflow.end() && it->first <= last_index; ++it) {
+            if (range(it->first, it->second)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static size_t used_memory_of(const chunk_list &chunks)
+    {
+        size_t used =
+            chunks.direct.capacity() * sizeof(std::unique_ptr<chunk>);
+        for (const auto &c : chunks.direct) {
+            if (c) {
+                used += c->used_memory();
+            }
+        }
+        for (const auto &c : chunks.overflow) {
+            used += c.second.used_memory();
+        }
+        return used;
+    }
+
+    static uint64_t negated(osmium::object_id_type id)
+    {
+        return 0 - static_cast<uint64_t>(id);
+    }
+
+public:
+    void set(osmium::object_id_type id)
+    {
+        const bool added = id >= 0 ? set_in(m_positive, uint64_t(id))
+                                   : set_in(m_negative, negated(id));
+        if (added) {
+            ++m_size;
+        }
+    }
+
+    bool get(osmium::object_id_type id) const
+    {
+        return id >= 0 ? get_in(m_positive, uint64_t(id))
+                       : get_in(m_negative, negated(id));
+    }
+
+    /// Is any ID from first to last, inclusive, in the set?
+    bool any_in(osmium::object_id_type first,
+                osmium::object_id_type last) const
+    {
+        if (first > last) {
+            return false;
+        }
+        if (last >= 0) {
+            const uint64_t from = first < 0 ? 0 : uint64_t(first);
+            if (any_in_list(m_positive, from, uint64_t(last))) {
+                return true;
+            }
+        }
+        if (first < 0) {
+            // Negative IDs are stored by their absolute value
+            const uint64_t from = negated(last < 0 ? last : -1);
+            return any_in_list(m_negative, from, negated(first));
+        }
+        return false;
+    }
+
+    /// Number of IDs in the set
+    size_t size() const { return m_size; }
+
+    bool empty() const { return m_size == 0; }
+
+    size_t used_memory() const
+    {
+        return used_memory_of(m_positive) + used_memory_of(m_negative);
+    }
+};
+
+#endif // IDSET_HPP
@@ -0,0 +1,144 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "linemerge.hpp"
+
+namespace {
+
+const size_t no_partner = static_cast<size_t>(-1);
+
+// One end of a line. Ends 2 * i and 2 * i + 1 are the first and last node
+// of line i.
+struct line_end
+{
+    int attributes;
+    osmium::object_id_type node;
+    size_t end;
+
+    bool operator<(const line_end &other) const
+    {
+        if (attributes != other.attributes) {
+            return attributes < other.attributes;
+        }
+        if (node != other.node) {
+            return node < other.node;
+        }
+        return end < other.end;
+    }
+};
+
+int attributes(const BorderLine &line)
+{
+    return line.admin_level * 8 + (line.dividing_line ? 4 : 0) +
+           (line.disputed ? 2 : 0) + (line.maritime ? 1 : 0);
+}
+
+} // anonymous namespace
+
+std::vector<BorderLine> merge_lines(std::vector<WayLine> &&lines)
+{
+    // Endpoint index: line ends sorted by node, for each set of attributes
+    std::vector<line_end> ends;
+    ends.reserve(2 * lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        const int a = attributes(lines[i].line);
+        ends.push_back(line_end{a, lines[i].first_node, 2 * i});
+        ends.push_back(line_end{a, lines[i].last_node, 2 * i + 1});
+    }
+    std::sort(ends.begin(), ends.end());
+
+    // The end each line end is joined to, if any
+    std::vector<size_t> partner(ends.size(), no_partner);
+    for (size_t i = 0; i < ends.size();) {
+        size_t j = i + 1;
+        while (j < ends.size() && ends[j].attributes == ends[i].attributes &&
+               ends[j].node == ends[i].node) {
+            ++j;
+        }
+        // A closed way has both its ends here, and is already complete
+        if (j - i == 2 && ends[i].end / 2 != ends[i + 1].end / 2) {
+            partner[ends[i].end] = ends[i + 1].end;
+            partner[ends[i + 1].end] = ends[i].end;
+        }
+        i = j;
+    }
+
+    std::vector<BorderLine> merged;
+    std::vector<bool> used(lines.size(), false);
+    for (size_t seed = 0; seed < lines.size(); ++seed) {
+        if (used[seed]) {
+            continue;
+        }
+
+        // Go back to the start of the chain. start is the end of line
+        // where walking the chain enters it. If the chain is a ring, it
+        // starts with the seed.
+        size_t line = seed;
+        size_t start = 2 * seed;
+        while (partner[start] != no_partner) {
+            const size_t previous = partner[start] / 2;
+            if (previous == seed) {
+                line = seed;
+                start = 2 * seed;
+                break;
+            }
+            line = previous;
+            start = partner[start] ^ 1;
+        }
+
+        BorderLine result;
+        result.admin_level = lines[line].line.admin_level;
+        result.dividing_line = lines[line].line.dividing_line;
+        result.disputed = lines[line].line.disputed;
+        result.maritime = lines[line].line.maritime;
+        result.id = lines[line].line.id;
+        for (;;) {
+            used[line] = true;
+            BorderLine &part = lines[line].line;
+            if (start & 1) {
+                std::reverse(part.coordinates.begin(),
+                             part.coordinates.end());
+            }
+            // The first point is the last point of the previous part
+            const size_t skip = result.coordinates.empty() ? 0 : 1;
+            result.coordinates.insert(result.coordinates.end(),
+                                      part.coordinates.begin() + skip,
+                                      part.coordinates.end());
+            std::vector<osmium::geom::Coordinates>().swap(part.coordinates);
+            result.way_ids.push_back(part.id);
+            result.id = std::min(result.id, part.id);
+
+            const size_t next = partner[start ^ 1];
+            if (next == no_partner || used[next / 2]) {
+                break;
+            }
+            line = next / 2;
+            start = next;
+        }
+        merged.push_back(std::move(result));
+    }
+    return merged;
+}
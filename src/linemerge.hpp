@@ -0,0 +1,51 @@
+#ifndef LINEMERGE_HPP
+#define LINEMERGE_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+#include "borderline.hpp"
+
+/// The line of a single way, with the nodes at its ends
+struct WayLine
+{
+    BorderLine line;
+    osmium::object_id_type first_node;
+    osmium::object_id_type last_node;
+};
+
+/**
+ * Join lines with the same attributes that meet end to end into longer
+ * lines, much like OSMCoastline joins coastline ways into rings.
+ *
+ * Lines are only joined at nodes where exactly two ends of lines with the
+ * same attributes meet, so the result doesn't depend on any arbitrary
+ * choice at junctions. Lines may be reversed to join them. Each merged
+ * line gets the lowest ID of its ways and lists all of them, in order, in
+ * way_ids. The merged lines come out in the order of the first of their
+ * ways in the input.
+ */
+std::vector<BorderLine> merge_lines(std::vector<WayLine> &&lines);
+
+#endif // LINEMERGE_HPP
@@ -0,0 +1,211 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "flatgeobuf.hpp"
+#include "linesink.hpp"
+#include "pgcopy.hpp"
+#include "wkb.hpp"
+
+namespace {
+
+/// Base for the formats with one row per line
+class RowSink : public LineSink
+{
+public:
+    RowSink(OutputWriter &out, bool way_ids, RowDiff *diff)
+    : m_out(out), m_way_ids(way_ids), m_diff(diff)
+    {
+    }
+
+    void write(const BorderLine &line) override
+    {
+        m_wkb.clear();
+        wkb::append_ewkb_linestring(m_wkb, line.coordinates);
+        append_row(line);
+        if (m_rows.size() >= flush_size) {
+            flush();
+        }
+    }
+
+    void finish() override { flush(); }
+
+protected:
+    OutputWriter &m_out;
+    const bool m_way_ids;
+    // Rows not handed to m_out yet
+    std::string m_rows;
+    // Reused for the WKB of each line
+    std::string m_wkb;
+
+    /// Add the row for line to m_rows. m_wkb holds its geometry.
+    virtual void append_row(const BorderLine &line) = 0;
+
+    void flush()
+    {
+        if (m_rows.empty()) {
+            return;
+        }
+        if (m_diff) {
+            m_diff->add_rows(m_rows);
+        }
+        m_out.write(std::move(m_rows));
+        m_rows = std::string();
+    }
+
+private:
+    // Rows are collected until there are this many bytes of them
+    static constexpr size_t flush_size = 256 * 1024;
+
+    RowDiff *m_diff;
+};
+
+class CsvSink : public RowSink
+{
+public:
+    using RowSink::RowSink;
+
+private:
+    void append_row(const BorderLine &line) override
+    {
+        append_int(m_rows, line.id);
+        m_rows += '\t';
+        append_int(m_rows, line.admin_level);
+        m_rows += '\t';
+        m_rows += (line.dividing_line) ? ("true") : ("false");
+        m_rows += '\t';
+        m_rows += (line.disputed) ? ("true") : ("false");
+        m_rows += '\t';
+        m_rows += (line.maritime) ? ("true") : ("false");
+        m_rows += '\t';
+        append_hex(m_rows, m_wkb);
+        if (m_way_ids) {
+            // Array in the PostgreSQL text format
+            m_rows += "\t{";
+            for (size_t i = 0; i < line.way_ids.size(); ++i) {
+                if (i > 0) {
+                    m_rows += ',';
+                }
+                append_int(m_rows, line.way_ids[i]);
+            }
+            m_rows += '}';
+        }
+        m_rows += '\n';
+    }
+};
+
+class PgCopySink : public RowSink
+{
+public:
+    PgCopySink(OutputWriter &out, bool way_ids) : RowSink(out, way_ids, nullptr)
+    {
+    }
+
+    void begin() override { pgcopy::append_header(m_rows); }
+
+    void finish() override
+    {
+        pgcopy::append_trailer(m_rows);
+        flush();
+    }
+
+private:
+    void append_row(const BorderLine &line) override
+    {
+        pgcopy::append_tuple(m_rows, m_way_ids ? 7 : 6);
+        pgcopy::append_bigint_field(m_rows, line.id);
+        pgcopy::append_int_field(m_rows, line.admin_level);
+        pgcopy::append_bool_field(m_rows, line.dividing_line);
+        pgcopy::append_bool_field(m_rows, line.disputed);
+        pgcopy::append_bool_field(m_rows, line.maritime);
+        pgcopy::append_bytes_field(m_rows, m_wkb);
+        if (m_way_ids) {
+            pgcopy::append_bigint_array_field(m_rows, line.way_ids);
+        }
+    }
+};
+
+class FlatGeobufSink : public LineSink
+{
+public:
+    FlatGeobufSink(OutputWriter &out, bool way_ids)
+    : m_out(out), m_way_ids(way_ids)
+    {
+    }
+
+    void write(const BorderLine &line) override
+    {
+        m_features.push_back(flatgeobuf::encode_feature(line));
+    }
+
+    void finish() override
+    {
+        flatgeobuf::write_file(m_out, m_features, m_way_ids);
+        m_features.clear();
+    }
+
+private:
+    OutputWriter &m_out;
+    const bool m_way_ids;
+    // FlatGeobuf needs all features before it can write the index
+    std::vector<flatgeobuf::feature> m_features;
+};
+
+class TileSetSink : public LineSink
+{
+public:
+    explicit TileSetSink(mvt::TileSet &tiles) : m_tiles(tiles) {}
+
+    void write(const BorderLine &line) override
+    {
+        m_tiles.add(BorderLine(line));
+    }
+
+    void finish() override { m_tiles.write(); }
+
+private:
+    mvt::TileSet &m_tiles;
+};
+
+} // anonymous namespace
+
+std::unique_ptr<LineSink> make_line_sink(OutputWriter &out,
+                                         output_format format, bool way_ids,
+                                         RowDiff *diff)
+{
+    switch (format) {
+    case output_format::pgcopy_binary:
+        return std::unique_ptr<LineSink>{new PgCopySink{out, way_ids}};
+    case output_format::flatgeobuf:
+        return std::unique_ptr<LineSink>{new FlatGeobufSink{out, way_ids}};
+    default:
+        return std::unique_ptr<LineSink>{new CsvSink{out, way_ids, diff}};
+    }
+}
+
+std::unique_ptr<LineSink> make_tile_sink(mvt::TileSet &tiles)
+{
+    return std::unique_ptr<LineSink>{new TileSetSink{tiles}};
+}
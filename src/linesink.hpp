@@ -0,0 +1,66 @@
+#ifndef LINESINK_HPP
+#define LINESINK_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <memory>
+
+#include "borderline.hpp"
+#include "mvt.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "rowdiff.hpp"
+
+/**
+ * Somewhere border lines go, in one output format. A sink is only used
+ * from one thread at a time, the one of the LineWriter it is handed to.
+ */
+class LineSink
+{
+public:
+    virtual ~LineSink() = default;
+
+    /// Called before the first line.
+    virtual void begin() {}
+
+    virtual void write(const BorderLine &line) = 0;
+
+    /**
+     * Called after the last line. For FlatGeobuf and tiles this is where
+     * everything is written.
+     */
+    virtual void finish() {}
+};
+
+/**
+ * Make the sink for format writing to out. With way_ids set, there is an
+ * extra column with the IDs of the ways each line was merged from. If diff
+ * is set, the csv rows are also compared with an earlier run.
+ */
+std::unique_ptr<LineSink> make_line_sink(OutputWriter &out,
+                                         output_format format,
+                                         bool way_ids = false,
+                                         RowDiff *diff = nullptr);
+
+/// Make a sink that collects the lines in tiles and writes them at the end.
+std::unique_ptr<LineSink> make_tile_sink(mvt::TileSet &tiles);
+
+#endif // LINESINK_HPP
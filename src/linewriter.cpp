@@ -0,0 +1,124 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <utility>
+
+#include "linewriter.hpp"
+
+LineWriter::LineWriter(std::unique_ptr<LineSink> sink)
+: m_sink(std::move(sink))
+{
+}
+
+LineWriter::~LineWriter() { cancel(); }
+
+void LineWriter::begin() { m_thread = std::thread(&LineWriter::run, this); }
+
+void LineWriter::write(batch lines)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space_cv.wait(lock,
+                    [this] { return m_queue.size() < max_queued || m_error; });
+    if (m_error) {
+        lock.unlock();
+        rethrow_error();
+    }
+    m_queue.push_back(std::move(lines));
+    m_queue_cv.notify_one();
+}
+
+void LineWriter::end_input()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_queue_cv.notify_one();
+}
+
+void LineWriter::finish()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+    end_input();
+    m_thread.join();
+    rethrow_error();
+}
+
+void LineWriter::cancel()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancel = true;
+    }
+    m_queue_cv.notify_one();
+    m_thread.join();
+}
+
+void LineWriter::rethrow_error()
+{
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        error = m_error;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void LineWriter::run()
+{
+    try {
+        m_sink->begin();
+        for (;;) {
+            batch lines;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_queue_cv.wait(lock, [this] {
+                    return m_cancel || m_done || !m_queue.empty();
+                });
+                if (m_cancel) {
+                    return;
+                }
+                if (m_queue.empty()) {
+                    break;
+                }
+                lines = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            m_space_cv.notify_one();
+            for (const auto &line : *lines) {
+                m_sink->write(line);
+            }
+        }
+        m_sink->finish();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = std::current_exception();
+        m_queue.clear();
+        m_space_cv.notify_all();
+    }
+}
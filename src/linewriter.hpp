@@ -0,0 +1,99 @@
+#ifndef LINEWRITER_HPP
+#define LINEWRITER_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "borderline.hpp"
+#include "linesink.hpp"
+
+/**
+ * Hands border lines to a LineSink on a thread of its own, so formatting
+ * and writing each output runs alongside building the lines and the other
+ * outputs.
+ *
+ * Lines come in batches that several writers can share. write() only
+ * blocks while max_queued batches are waiting for the sink.
+ */
+class LineWriter
+{
+public:
+    typedef std::shared_ptr<const std::vector<BorderLine>> batch;
+
+    explicit LineWriter(std::unique_ptr<LineSink> sink);
+
+    /// Calls cancel().
+    ~LineWriter();
+
+    LineWriter(const LineWriter &) = delete;
+    LineWriter &operator=(const LineWriter &) = delete;
+
+    /// Start the thread, which calls LineSink::begin().
+    void begin();
+
+    /**
+     * Queue lines for the sink. Throws whatever the sink threw for earlier
+     * lines.
+     */
+    void write(batch lines);
+
+    /// Tell the sink there are no more lines, without waiting for it.
+    void end_input();
+
+    /**
+     * Wait until the sink has written all lines and finished. Throws
+     * whatever the sink threw.
+     */
+    void finish();
+
+    /**
+     * Stop the thread without writing the lines still queued or finishing
+     * the sink. Does nothing after finish().
+     */
+    void cancel();
+
+private:
+    static constexpr size_t max_queued = 16;
+
+    std::unique_ptr<LineSink> m_sink;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queue_cv;
+    std::condition_variable m_space_cv;
+    std::deque<batch> m_queue;
+    bool m_done = false;
+    // Set to stop without writing the rest of the queue
+    bool m_cancel = false;
+    std::exception_ptr m_error;
+    std::thread m_thread;
+
+    void rethrow_error();
+    void run();
+};
+
+#endif // LINEWRITER_HPP
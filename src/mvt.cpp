@@ -0,0 +1,701 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _MSC_VER
+#include <direct.h>
+#endif
+
+#ifdef OSMBORDER_HAVE_SQLITE
+#include <sqlite3.h>
+#endif
+
+#include "compress.hpp"
+#include "mvt.hpp"
+#include "parallel.hpp"
+#include "simplify.hpp"
+
+namespace mvt {
+
+const char *const layer_name = "osmborder_lines";
+
+} // namespace mvt
+
+namespace {
+
+// Half the width of the web mercator world
+const double world_half = 20037508.342789244;
+const double world_size = 2 * world_half;
+
+// Tile coordinates go from 0 to extent, and lines are kept up to buffer
+// outside of that so the line caps and joins don't show at tile edges
+const int extent = 4096;
+const int buffer = 64;
+
+// Lines are simplified to this many tile units before clipping
+const double pixel_tolerance = 0.5;
+
+// Number of tiles or lines handed to a worker thread at a time
+const size_t tiles_per_chunk = 64;
+const size_t lines_per_chunk = 256;
+
+typedef std::pair<int32_t, int32_t> point;
+
+// Protocol buffer wire types
+const uint32_t wire_varint = 0;
+const uint32_t wire_bytes = 2;
+
+void put_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+void put_key(std::string &out, uint32_t field, uint32_t wire_type)
+{
+    put_varint(out, (field << 3) | wire_type);
+}
+
+void put_bytes(std::string &out, uint32_t field, const std::string &data)
+{
+    put_key(out, field, wire_bytes);
+    put_varint(out, data.size());
+    out += data;
+}
+
+uint32_t zigzag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^
+           static_cast<uint32_t>(value >> 31);
+}
+
+uint32_t command(uint32_t id, uint32_t count) { return (id & 7) | (count << 3); }
+
+/// Index of the tile containing offset, clamped to the world.
+uint32_t tile_index(double offset, double tile_size, uint32_t num_tiles)
+{
+    const double index = std::floor(offset / tile_size);
+    if (index < 0.0) {
+        return 0;
+    }
+    if (index >= num_tiles) {
+        return num_tiles - 1;
+    }
+    return static_cast<uint32_t>(index);
+}
+
+/**
+ * Add the tiles the segment from a to b passes through, in web mercator
+ * with margin around each tile, as (x << 32 | y, segment) to tiles.
+ */
+void segment_tiles(const osmium::geom::Coordinates &a,
+                   const osmium::geom::Coordinates &b, uint32_t segment,
+                   double tile_size, uint32_t num_tiles, double margin,
+                   std::vector<std::pair<uint64_t, uint32_t>> &tiles)
+{
+    const double min_x = std::min(a.x, b.x);
+    const double max_x = std::max(a.x, b.x);
+    const uint32_t first_x =
+        tile_index(min_x - margin + world_half, tile_size, num_tiles);
+    const uint32_t last_x =
+        tile_index(max_x + margin + world_half, tile_size, num_tiles);
+    for (uint64_t tx = first_x; tx <= last_x; ++tx) {
+        // The part of the segment in this column of tiles
+        double x0 = std::max(min_x, tx * tile_size - world_half - margin);
+        double x1 =
+            std::min(max_x, (tx + 1) * tile_size - world_half + margin);
+        if (x0 > x1) {
+            // Outside of the world, in the first or last column
+            x0 = min_x;
+            x1 = max_x;
+        }
+        double y0 = a.y;
+        double y1 = b.y;
+        if (b.x != a.x) {
+            y0 = a.y + (x0 - a.x) / (b.x - a.x) * (b.y - a.y);
+            y1 = a.y + (x1 - a.x) / (b.x - a.x) * (b.y - a.y);
+        }
+        const uint32_t first_y =
+            tile_index(world_half - std::max(y0, y1) - margin, tile_size,
+                       num_tiles);
+        const uint32_t last_y =
+            tile_index(world_half - std::min(y0, y1) + margin, tile_size,
+                       num_tiles);
+        for (uint64_t ty = first_y; ty <= last_y; ++ty) {
+            tiles.emplace_back((tx << 32) | ty, segment);
+        }
+    }
+}
+
+/**
+ * Clip the segment from a to b to the square from min to max with the
+ * Liang-Barsky algorithm. On success t0 and t1 are the parameters of the
+ * clipped end points along the segment.
+ */
+bool clip_segment(const osmium::geom::Coordinates &a,
+                  const osmium::geom::Coordinates &b, double min, double max,
+                  double &t0, double &t1)
+{
+    const double dx = b.x - a.x;
+    const double dy = b.y - a.y;
+    const double p[4] = {-dx, dx, -dy, dy};
+    const double q[4] = {a.x - min, max - a.x, a.y - min, max - a.y};
+
+    t0 = 0.0;
+    t1 = 1.0;
+    for (int i = 0; i < 4; ++i) {
+        if (p[i] == 0.0) {
+            if (q[i] < 0.0) {
+                return false;
+            }
+            continue;
+        }
+        const double r = q[i] / p[i];
+        if (p[i] < 0.0) {
+            t0 = std::max(t0, r);
+        } else {
+            t1 = std::min(t1, r);
+        }
+        if (t0 > t1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void add_point(std::vector<point> &part, const osmium::geom::Coordinates &a,
+               const osmium::geom::Coordinates &b, double t)
+{
+    const point p{
+        static_cast<int32_t>(std::lround(a.x + t * (b.x - a.x))),
+        static_cast<int32_t>(std::lround(a.y + t * (b.y - a.y)))};
+    if (part.empty() || part.back() != p) {
+        part.push_back(p);
+    }
+}
+
+/**
+ * Clip a line in tile units to the square from min to max, rounding to
+ * whole units. Each time the line leaves the square a new part starts.
+ */
+void clip_line(const std::vector<osmium::geom::Coordinates> &points,
+               double min, double max, std::vector<std::vector<point>> &parts)
+{
+    parts.clear();
+    // Is the line still inside at the end of the last part?
+    bool inside = false;
+    for (size_t i = 1; i < points.size(); ++i) {
+        const auto &a = points[i - 1];
+        const auto &b = points[i];
+        double t0;
+        double t1;
+        if (!clip_segment(a, b, min, max, t0, t1)) {
+            inside = false;
+            continue;
+        }
+        if (!inside || t0 > 0.0) {
+            parts.emplace_back();
+            add_point(parts.back(), a, b, t0);
+        }
+        add_point(parts.back(), a, b, t1);
+        inside = t1 >= 1.0;
+    }
+    parts.erase(std::remove_if(parts.begin(), parts.end(),
+                               [](const std::vector<point> &part) {
+                                   return part.size() < 2;
+                               }),
+                parts.end());
+}
+
+void make_directory(const std::string &path)
+{
+#ifndef _MSC_VER
+    const int result = ::mkdir(path.c_str(), 0777);
+#else
+    const int result = ::_mkdir(path.c_str());
+#endif
+    if (result != 0 && errno != EEXIST) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can't create directory '" + path + "'"};
+    }
+}
+
+/// Tiles in z/x/y.pbf files below a directory.
+class DirectorySink : public mvt::TileSink
+{
+    const std::string m_path;
+    // The tiles come sorted by x within each zoom level, so only the
+    // directories of the last ones can already exist.
+    int m_zoom = -1;
+    int64_t m_x = -1;
+
+public:
+    explicit DirectorySink(const std::string &path) : m_path(path)
+    {
+        make_directory(m_path);
+    }
+
+    void write(int zoom, uint32_t x, uint32_t y,
+               const std::string &data) override
+    {
+        std::string path = m_path + '/' + std::to_string(zoom);
+        if (zoom != m_zoom) {
+            make_directory(path);
+            m_zoom = zoom;
+            m_x = -1;
+        }
+        path += '/' + std::to_string(x);
+        if (x != m_x) {
+            make_directory(path);
+            m_x = x;
+        }
+        path += '/' + std::to_string(y) + ".pbf";
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        out.close();
+        if (!out) {
+            throw std::runtime_error{"Error writing tile '" + path + "'"};
+        }
+    }
+
+    void close() override {}
+};
+
+#ifdef OSMBORDER_HAVE_SQLITE
+
+/**
+ * Tiles in an MBTiles file (https://github.com/mapbox/mbtiles-spec). Rows
+ * in MBTiles count from the bottom, and vector tiles are stored gzipped.
+ */
+class MBTilesSink : public mvt::TileSink
+{
+    const std::string m_path;
+    const int m_min_zoom;
+    const int m_max_zoom;
+    sqlite3 *m_db = nullptr;
+    sqlite3_stmt *m_insert = nullptr;
+
+    [[noreturn]] void fail() const
+    {
+        throw std::runtime_error{"Error writing '" + m_path +
+                                 "': " + sqlite3_errmsg(m_db)};
+    }
+
+    void exec(const char *sql)
+    {
+        if (sqlite3_exec(m_db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+            fail();
+        }
+    }
+
+    void add_metadata(sqlite3_stmt *statement, const char *name,
+                      const std::string &value)
+    {
+        sqlite3_bind_text(statement, 1, name, -1, SQLITE_STATIC);
+        sqlite3_bind_text(statement, 2, value.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(statement) != SQLITE_DONE) {
+            fail();
+        }
+        sqlite3_reset(statement);
+    }
+
+public:
+    MBTilesSink(const std::string &path, int min_zoom, int max_zoom)
+    : m_path(path), m_min_zoom(min_zoom), m_max_zoom(max_zoom)
+    {
+        // Like the other outputs, an existing file is replaced
+        std::remove(path.c_str());
+        if (sqlite3_open(path.c_str(), &m_db) != SQLITE_OK) {
+            const std::string message =
+                m_db ? sqlite3_errmsg(m_db) : "out of memory";
+            sqlite3_close(m_db);
+            m_db = nullptr;
+            throw std::runtime_error{"Can't open '" + path +
+                                     "': " + message};
+        }
+        try {
+            exec("PRAGMA synchronous = OFF");
+            exec("CREATE TABLE metadata (name TEXT, value TEXT)");
+            exec("CREATE TABLE tiles (zoom_level INTEGER, tile_column "
+                 "INTEGER, tile_row INTEGER, tile_data BLOB)");
+            exec("BEGIN");
+            if (sqlite3_prepare_v2(m_db, "INSERT INTO tiles VALUES (?, ?, "
+                                         "?, ?)",
+                                   -1, &m_insert, nullptr) != SQLITE_OK) {
+                fail();
+            }
+        } catch (...) {
+            sqlite3_close(m_db);
+            throw;
+        }
+    }
+
+    ~MBTilesSink() override
+    {
+        sqlite3_finalize(m_insert);
+        sqlite3_close(m_db);
+    }
+
+    bool wants_gzip() const override { return true; }
+
+    void write(int zoom, uint32_t x, uint32_t y,
+               const std::string &data) override
+    {
+        const int64_t row = (int64_t(1) << zoom) - 1 - y;
+        sqlite3_bind_int(m_insert, 1, zoom);
+        sqlite3_bind_int64(m_insert, 2, x);
+        sqlite3_bind_int64(m_insert, 3, row);
+        sqlite3_bind_blob(m_insert, 4, data.data(),
+                          static_cast<int>(data.size()), SQLITE_STATIC);
+        if (sqlite3_step(m_insert) != SQLITE_DONE) {
+            fail();
+        }
+        sqlite3_reset(m_insert);
+    }
+
+    void close() override
+    {
+        if (!m_insert) {
+            return;
+        }
+        sqlite3_finalize(m_insert);
+        m_insert = nullptr;
+
+        sqlite3_stmt *statement = nullptr;
+        if (sqlite3_prepare_v2(m_db, "INSERT INTO metadata VALUES (?, ?)", -1,
+                               &statement, nullptr) != SQLITE_OK) {
+            fail();
+        }
+        const std::string min_zoom = std::to_string(m_min_zoom);
+        const std::string max_zoom = std::to_string(m_max_zoom);
+        try {
+            add_metadata(statement, "name", mvt::layer_name);
+            add_metadata(statement, "format", "pbf");
+            add_metadata(statement, "type", "overlay");
+            add_metadata(statement, "bounds",
+                         "-180,-85.05113,180,85.05113");
+            add_metadata(statement, "minzoom", min_zoom);
+            add_metadata(statement, "maxzoom", max_zoom);
+            add_metadata(statement, "json",
+                         std::string{"{\"vector_layers\":[{\"id\":\""} +
+                             mvt::layer_name +
+                             "\",\"fields\":{\"admin_level\":\"Number\","
+                             "\"dividing_line\":\"Boolean\","
+                             "\"disputed\":\"Boolean\","
+                             "\"maritime\":\"Boolean\"},"
+                             "\"minzoom\":" +
+                             min_zoom + ",\"maxzoom\":" + max_zoom + "}]}");
+        } catch (...) {
+            sqlite3_finalize(statement);
+            throw;
+        }
+        sqlite3_finalize(statement);
+
+        exec("CREATE UNIQUE INDEX tile_index ON tiles (zoom_level, "
+             "tile_column, tile_row)");
+        exec("COMMIT");
+        if (sqlite3_close(m_db) != SQLITE_OK) {
+            fail();
+        }
+        m_db = nullptr;
+    }
+};
+
+#endif
+
+bool ends_with(const std::string &text, const std::string &suffix)
+{
+    return text.size() >= suffix.size() &&
+           text.compare(text.size() - suffix.size(), suffix.size(),
+                        suffix) == 0;
+}
+
+} // anonymous namespace
+
+namespace mvt {
+
+std::unique_ptr<TileSink> open_sink(const std::string &path, int min_zoom,
+                                    int max_zoom)
+{
+    if (ends_with(path, ".mbtiles")) {
+#ifdef OSMBORDER_HAVE_SQLITE
+        return std::unique_ptr<TileSink>{
+            new MBTilesSink{path, min_zoom, max_zoom}};
+#else
+        throw std::runtime_error{"This osmborder was built without SQLite, "
+                                 "so it can't write MBTiles files"};
+#endif
+    }
+    return std::unique_ptr<TileSink>{new DirectorySink{path}};
+}
+
+TileSet::TileSet(TileSink &sink, int min_zoom, int max_zoom,
+                 unsigned int num_threads)
+: m_sink(sink), m_min_zoom(min_zoom), m_max_zoom(max_zoom),
+  m_num_threads(num_threads)
+{
+}
+
+void TileSet::add(BorderLine &&line) { m_lines.push_back(std::move(line)); }
+
+std::string TileSet::encode_tile(int zoom, uint32_t x, uint32_t y,
+                                 const simplified &lines,
+                                 const std::pair<uint64_t, piece> *first,
+                                 const std::pair<uint64_t, piece> *last) const
+{
+    const double tile_size = world_size / (uint32_t(1) << zoom);
+    const double left = x * tile_size - world_half;
+    const double top = world_half - y * tile_size;
+    const double scale = extent / tile_size;
+
+    std::string features;
+    // Encoded Value messages and their index in the layer
+    std::map<std::string, uint32_t> values;
+    const auto value_index = [&values](uint32_t field, uint64_t value) {
+        std::string encoded;
+        put_key(encoded, field, wire_varint);
+        put_varint(encoded, value);
+        return values
+            .emplace(std::move(encoded), static_cast<uint32_t>(values.size()))
+            .first->second;
+    };
+
+    std::vector<osmium::geom::Coordinates> points;
+    std::vector<std::vector<point>> parts;
+    std::string tags;
+    std::string geometry;
+    std::string feature;
+    for (auto it = first; it != last; ++it) {
+        const piece &p = it->second;
+        const BorderLine &line = m_lines[p.line];
+        const auto &coordinates = lines[p.line];
+
+        points.clear();
+        for (uint32_t i = p.first; i <= p.last + 1; ++i) {
+            const auto &c = coordinates[i];
+            points.emplace_back((c.x - left) * scale, (top - c.y) * scale);
+        }
+        clip_line(points, -buffer, extent + buffer, parts);
+        if (parts.empty()) {
+            continue;
+        }
+
+        // Keys are in the order written at the end, values are int_value
+        // (4) and bool_value (7)
+        tags.clear();
+        put_varint(tags, 0);
+        put_varint(tags, value_index(4, static_cast<uint64_t>(
+                                            int64_t(line.admin_level))));
+        put_varint(tags, 1);
+        put_varint(tags, value_index(7, line.dividing_line));
+        put_varint(tags, 2);
+        put_varint(tags, value_index(7, line.disputed));
+        put_varint(tags, 3);
+        put_varint(tags, value_index(7, line.maritime));
+
+        // MoveTo (1) the start of each part, then LineTo (2) the rest, all
+        // relative to the previous point
+        geometry.clear();
+        point cursor{0, 0};
+        for (const auto &part : parts) {
+            put_varint(geometry, command(1, 1));
+            put_varint(geometry, zigzag(part[0].first - cursor.first));
+            put_varint(geometry, zigzag(part[0].second - cursor.second));
+            put_varint(geometry,
+                       command(2, static_cast<uint32_t>(part.size() - 1)));
+            for (size_t i = 1; i < part.size(); ++i) {
+                put_varint(geometry, zigzag(part[i].first - part[i - 1].first));
+                put_varint(geometry,
+                           zigzag(part[i].second - part[i - 1].second));
+            }
+            cursor = part.back();
+        }
+
+        feature.clear();
+        if (line.id >= 0) {
+            put_key(feature, 1, wire_varint);
+            put_varint(feature, static_cast<uint64_t>(line.id));
+        }
+        put_bytes(feature, 2, tags);
+        // LINESTRING
+        put_key(feature, 3, wire_varint);
+        put_varint(feature, 2);
+        put_bytes(feature, 4, geometry);
+        put_bytes(features, 2, feature);
+    }
+
+    if (features.empty()) {
+        return std::string();
+    }
+
+    std::string layer;
+    put_bytes(layer, 1, layer_name);
+    layer += features;
+    for (const char *key :
+         {"admin_level", "dividing_line", "disputed", "maritime"}) {
+        put_bytes(layer, 3, key);
+    }
+    std::vector<const std::string *> ordered(values.size());
+    for (const auto &v : values) {
+        ordered[v.second] = &v.first;
+    }
+    for (const auto *v : ordered) {
+        put_bytes(layer, 4, *v);
+    }
+    put_key(layer, 5, wire_varint);
+    put_varint(layer, extent);
+    put_key(layer, 15, wire_varint);
+    put_varint(layer, 2);
+
+    std::string tile;
+    put_bytes(tile, 3, layer);
+    // MBTiles expects gzipped vector tiles
+    return m_sink.wants_gzip() ? compress(tile, compression::gzip) : tile;
+}
+
+void TileSet::write()
+{
+    for (int zoom = m_min_zoom; zoom <= m_max_zoom; ++zoom) {
+        const uint32_t num_tiles = uint32_t(1) << zoom;
+        const double tile_size = world_size / num_tiles;
+        const double margin = tile_size * buffer / extent;
+        const double tolerance = tile_size * pixel_tolerance / extent;
+
+        // Simplify each line once for the zoom level, and find the pieces
+        // of it in each tile from its segments
+        simplified lines(m_lines.size());
+        std::vector<std::pair<uint64_t, piece>> entries;
+        {
+            const size_t num_chunks =
+                (m_lines.size() + lines_per_chunk - 1) / lines_per_chunk;
+            std::vector<std::vector<std::pair<uint64_t, piece>>> out(
+                num_chunks);
+            run_ordered(
+                num_chunks, m_num_threads,
+                [&](size_t chunk, unsigned int) {
+                    std::vector<std::pair<uint64_t, uint32_t>> tiles;
+                    const size_t end = std::min(
+                        m_lines.size(), (chunk + 1) * lines_per_chunk);
+                    for (size_t i = chunk * lines_per_chunk; i < end; ++i) {
+                        const auto &points = lines[i] = simplify_line(
+                            m_lines[i].coordinates, tolerance);
+                        tiles.clear();
+                        for (size_t s = 0; s + 1 < points.size(); ++s) {
+                            segment_tiles(points[s], points[s + 1],
+                                          static_cast<uint32_t>(s), tile_size,
+                                          num_tiles, margin, tiles);
+                        }
+                        // One piece per tile, from its first to its last
+                        // segment
+                        std::sort(tiles.begin(), tiles.end());
+                        for (const auto &t : tiles) {
+                            auto &pieces = out[chunk];
+                            if (!pieces.empty() &&
+                                pieces.back().first == t.first &&
+                                pieces.back().second.line == i) {
+                                pieces.back().second.last = t.second;
+                            } else {
+                                pieces.emplace_back(
+                                    t.first,
+                                    piece{static_cast<uint32_t>(i), t.second,
+                                          t.second});
+                            }
+                        }
+                    }
+                },
+                [&](size_t chunk) {
+                    entries.insert(entries.end(), out[chunk].begin(),
+                                   out[chunk].end());
+                    out[chunk] = std::vector<std::pair<uint64_t, piece>>();
+                });
+        }
+
+        // Sorted so the lines of a tile are next to each other, in the
+        // order they were added
+        std::sort(entries.begin(), entries.end(),
+                  [](const std::pair<uint64_t, piece> &a,
+                     const std::pair<uint64_t, piece> &b) {
+                      return a.first < b.first ||
+                             (a.first == b.first &&
+                              a.second.line < b.second.line);
+                  });
+
+        // Tile and the position of its first piece in entries
+        std::vector<std::pair<uint64_t, size_t>> tiles;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (tiles.empty() || tiles.back().first != entries[i].first) {
+                tiles.emplace_back(entries[i].first, i);
+            }
+        }
+
+        const size_t num_chunks =
+            (tiles.size() + tiles_per_chunk - 1) / tiles_per_chunk;
+        std::vector<std::vector<std::string>> out(num_chunks);
+        run_ordered(
+            num_chunks, m_num_threads,
+            [&](size_t chunk, unsigned int) {
+                const size_t end =
+                    std::min(tiles.size(), (chunk + 1) * tiles_per_chunk);
+                for (size_t i = chunk * tiles_per_chunk; i < end; ++i) {
+                    const size_t last =
+                        i + 1 < tiles.size() ? tiles[i + 1].second
+                                             : entries.size();
+                    out[chunk].push_back(encode_tile(
+                        zoom, static_cast<uint32_t>(tiles[i].first >> 32),
+                        static_cast<uint32_t>(tiles[i].first), lines,
+                        entries.data() + tiles[i].second,
+                        entries.data() + last));
+                }
+            },
+            [&](size_t chunk) {
+                const size_t first = chunk * tiles_per_chunk;
+                for (size_t i = 0; i < out[chunk].size(); ++i) {
+                    if (out[chunk][i].empty()) {
+                        continue;
+                    }
+                    const uint64_t key = tiles[first + i].first;
+                    m_sink.write(zoom, static_cast<uint32_t>(key >> 32),
+                                 static_cast<uint32_t>(key), out[chunk][i]);
+                    ++m_tiles;
+                }
+                out[chunk] = std::vector<std::string>();
+            });
+    }
+}
+
+} // namespace mvt
@@ -0,0 +1,122 @@
+#ifndef MVT_HPP
+#define MVT_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osmium/geom/coordinates.hpp>
+
+#include "borderline.hpp"
+
+/**
+ * Mapbox Vector Tiles (https://github.com/mapbox/vector-tile-spec) made
+ * straight from the lines in web mercator. Each tile has one layer,
+ * "osmborder_lines", with the same attributes as the other formats. Like
+ * FlatGeobuf the protocol buffers are encoded directly, the schema being
+ * small and fixed.
+ */
+namespace mvt {
+
+/// Name of the layer in the tiles
+extern const char *const layer_name;
+
+/// Somewhere to put the encoded tiles.
+class TileSink
+{
+public:
+    virtual ~TileSink() = default;
+
+    /// Store one tile, with y counted from the top as in XYZ tiles.
+    virtual void write(int zoom, uint32_t x, uint32_t y,
+                       const std::string &data) = 0;
+
+    /// Should the tiles be gzipped before they are written?
+    virtual bool wants_gzip() const { return false; }
+
+    /// Called after the last tile, to finish up any metadata.
+    virtual void close() = 0;
+};
+
+/**
+ * Open a sink for the tiles at path. A path ending in ".mbtiles" is an
+ * MBTiles SQLite file, anything else a directory of z/x/y.pbf files.
+ * Throws std::runtime_error if that fails or if this was built without
+ * SQLite.
+ */
+std::unique_ptr<TileSink> open_sink(const std::string &path, int min_zoom,
+                                    int max_zoom);
+
+/**
+ * Collects the lines and cuts them into tiles for each zoom level from
+ * min_zoom to max_zoom.
+ */
+class TileSet
+{
+public:
+    TileSet(TileSink &sink, int min_zoom, int max_zoom,
+            unsigned int num_threads);
+
+    void add(BorderLine &&line);
+
+    /**
+     * Encode and write all tiles the lines touch. For each zoom level the
+     * lines are simplified once, and each segment is assigned to the tiles
+     * it passes through. The tiles are then encoded from their segments by
+     * the worker threads and handed to the sink in order.
+     */
+    void write();
+
+    /// Number of tiles written
+    size_t tiles() const { return m_tiles; }
+
+private:
+    /// The segments of a simplified line that pass through a tile
+    struct piece
+    {
+        uint32_t line;
+        // Index of the first point of the first and last segment
+        uint32_t first;
+        uint32_t last;
+    };
+
+    typedef std::vector<std::vector<osmium::geom::Coordinates>> simplified;
+
+    std::string encode_tile(int zoom, uint32_t x, uint32_t y,
+                            const simplified &lines,
+                            const std::pair<uint64_t, piece> *first,
+                            const std::pair<uint64_t, piece> *last) const;
+
+    TileSink &m_sink;
+    const int m_min_zoom;
+    const int m_max_zoom;
+    const unsigned int m_num_threads;
+    std::vector<BorderLine> m_lines;
+    size_t m_tiles = 0;
+};
+
+} // namespace mvt
+
+#endif // MVT_HPP
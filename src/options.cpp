@@ -19,49 +19,193 @@
 
 */
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <getopt.h>
 #include <iostream>
+#include <vector>
 
+#include "compress.hpp"
 #include "options.hpp"
+#include "parallel.hpp"
 #include "return_codes.hpp"
 
 #ifdef _MSC_VER
 #define strcasecmp _stricmp
 #endif
 
+namespace {
+
+// Highest zoom level vector tiles can be written for
+const long max_tile_zoom = 20;
+
+/// Set format from its name. Returns false for unknown formats.
+bool parse_format(const std::string &name, output_format &format)
+{
+    if (name == "csv") {
+        format = output_format::csv;
+    } else if (name == "pgcopy-binary") {
+        format = output_format::pgcopy_binary;
+    } else if (name == "flatgeobuf") {
+        format = output_format::flatgeobuf;
+    } else if (name == "mvt") {
+        format = output_format::mvt;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
 Options::Options(int argc, char *argv[])
-: inputfile(), debug(false), output_file(), overwrite_output(false),
-  verbose(false)
+: inputfile(), debug(false), output_file(), format(output_format::csv),
+  extra_outputs(), overwrite_output(false), verbose(false), merge_lines(false),
+  simplify_tolerances(), min_zoom(0), max_zoom(10), bbox(), polygon_file(),
+  extract_buffer(0.1), clip(false), shard_index(0), shard_count(1),
+  blob_index(false),
+  index_type("sparse_mem_array"), index_file(),
+  threads(default_num_threads()), state_dir(), update_dir(), diff_from(),
+  sql_diff_file(), stats_json(), rules_file()
 {
     static struct option long_options[] = {
+        {"also-output", required_argument, 0, 'A'},
+        {"bbox", required_argument, 0, 'b'},
+        {"extract-buffer", required_argument, 0, 'B'},
+        {"clip", no_argument, 0, 'C'},
         {"debug", no_argument, 0, 'd'},
+        {"diff-from", required_argument, 0, 'D'},
+        {"format", required_argument, 0, 'F'},
         {"help", no_argument, 0, 'h'},
+        {"blob-index", no_argument, 0, 'I'},
+        {"index-type", required_argument, 0, 'i'},
+        {"index-file", required_argument, 0, 'X'},
+        {"threads", required_argument, 0, 'j'},
+        {"stats-json", required_argument, 0, 'J'},
+        {"merge-lines", no_argument, 0, 'm'},
         {"output-file", required_argument, 0, 'o'},
         {"overwrite", no_argument, 0, 'f'},
+        {"polygon", required_argument, 0, 'p'},
+        {"shard", required_argument, 0, 'P'},
+        {"rules", required_argument, 0, 'R'},
+        {"simplify", required_argument, 0, 'T'},
+        {"sql-diff", required_argument, 0, 's'},
+        {"state-dir", required_argument, 0, 'S'},
+        {"update", required_argument, 0, 'u'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
+        {"zoom", required_argument, 0, 'z'},
         {0, 0, 0, 0}};
 
     while (1) {
-        int c = getopt_long(argc, argv, "dho:fvV", long_options, 0);
+        int c = getopt_long(argc, argv,
+                            "A:b:B:CdD:F:hIi:j:J:mo:fp:P:R:s:S:T:u:vVX:z:",
+                            long_options, 0);
         if (c == -1)
             break;
 
         switch (c) {
+        case 'A':
+            if (!parse_extra_output(optarg)) {
+                std::cerr << "--also-output/-A needs FORMAT:FILE with csv, "
+                             "pgcopy-binary or\n"
+                             "flatgeobuf as the format.\n";
+                std::exit(return_code_cmdline);
+            }
+            break;
+        case 'b':
+            if (!parse_bbox(optarg)) {
+                std::cerr << "--bbox/-b needs MINLON,MINLAT,MAXLON,MAXLAT.\n";
+                std::exit(return_code_cmdline);
+            }
+            break;
+        case 'B': {
+            char *end = nullptr;
+            extract_buffer = std::strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || !(extract_buffer >= 0.0)) {
+                std::cerr << "--extract-buffer/-B needs a number of degrees "
+                             "of at least 0.\n";
+                std::exit(return_code_cmdline);
+            }
+            break;
+        }
+        case 'C':
+            clip = true;
+            break;
         case 'd':
             debug = true;
             std::cerr << "Enabled debug option\n";
             break;
+        case 'D':
+            diff_from = optarg;
+            break;
+        case 'F':
+            if (!parse_format(optarg, format)) {
+                std::cerr << "Unknown output format '" << optarg << "'.\n";
+                std::exit(return_code_cmdline);
+            }
+            break;
         case 'h':
             print_help();
             std::exit(return_code_ok);
+        case 'I':
+            blob_index = true;
+            break;
+        case 'i':
+            index_type = optarg;
+            break;
+        case 'j': {
+            const int n = std::atoi(optarg);
+            if (n < 1) {
+                std::cerr << "Number of threads must be at least 1.\n";
+                std::exit(return_code_cmdline);
+            }
+            threads = static_cast<unsigned int>(n);
+            break;
+        }
+        case 'J':
+            stats_json = optarg;
+            break;
+        case 'm':
+            merge_lines = true;
+            break;
         case 'o':
             output_file = optarg;
             break;
         case 'f':
             overwrite_output = true;
             break;
+        case 'p':
+            polygon_file = optarg;
+            break;
+        case 'P':
+            if (!parse_shard(optarg)) {
+                std::cerr << "--shard/-P needs I/N with I from 1 to N.\n";
+                std::exit(return_code_cmdline);
+            }
+            break;
+        case 'R':
+            rules_file = optarg;
+            break;
+        case 's':
+            sql_diff_file = optarg;
+            break;
+        case 'S':
+            state_dir = optarg;
+            break;
+        case 'T':
+            if (!parse_tolerances(optarg)) {
+                std::cerr << "--simplify/-T needs a comma separated list of "
+                             "different positive\n"
+                             "numbers.\n";
+                std::exit(return_code_cmdline);
+            }
+            break;
+        case 'u':
+            update_dir = optarg;
+            break;
         case 'v':
             verbose = true;
             break;
@@ -75,13 +219,117 @@ Options::Options(int argc, char *argv[])
                    "redistribute it.\n"
                 << "There is NO WARRANTY, to the extent permitted by law.\n";
             std::exit(return_code_ok);
+        case 'X':
+            index_file = optarg;
+            break;
+        case 'z':
+            if (!parse_zoom_range(optarg)) {
+                std::cerr << "--zoom/-z needs a zoom level or a range MIN-MAX "
+                             "from 0 to "
+                          << max_tile_zoom << ".\n";
+                std::exit(return_code_cmdline);
+            }
+            break;
         default:
             std::exit(return_code_cmdline);
         }
     }
 
     if (optind != argc - 1) {
-        std::cerr << "Usage: " << argv[0] << " [OPTIONS] OSMFILE\n";
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS] OSMFILE\n"
+                  << "       " << argv[0]
+                  << " [OPTIONS] --update=DIR CHANGEFILE\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (!state_dir.empty() && !update_dir.empty()) {
+        std::cerr << "Can't use --state-dir/-S with --update/-u.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (!index_file.empty() && !update_dir.empty()) {
+        std::cerr << "--index-file/-X can't be used with --update/-u.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (!simplify_tolerances.empty() && !update_dir.empty()) {
+        std::cerr << "--simplify/-T can't be used with --update/-u.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (merge_lines && (!state_dir.empty() || !update_dir.empty())) {
+        std::cerr << "--merge-lines/-m can't be used with updates.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (format == output_format::mvt &&
+        (!update_dir.empty() || !simplify_tolerances.empty())) {
+        std::cerr << "--format=mvt can't be used with --update/-u or "
+                     "--simplify/-T.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (!extra_outputs.empty() && !update_dir.empty()) {
+        std::cerr << "--also-output/-A can't be used with --update/-u.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    const bool extract = !bbox.empty() || !polygon_file.empty();
+    if (!bbox.empty() && !polygon_file.empty()) {
+        std::cerr << "Can't use --bbox/-b with --polygon/-p.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (clip && !extract) {
+        std::cerr << "--clip/-C needs --bbox/-b or --polygon/-p.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    // Extracts can have several rows for a way, and their state and node
+    // locations would only cover the area
+    if (extract && (!state_dir.empty() || !update_dir.empty() ||
+                    !diff_from.empty() || !index_file.empty())) {
+        std::cerr << "Extracts can't be used with updates, --diff-from/-D "
+                     "or --index-file/-X.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    // Clipped ends have no node to merge lines at
+    if (clip && merge_lines) {
+        std::cerr << "--clip/-C can't be used with --merge-lines/-m.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    // Only rows can be merged, and lines only within a shard
+    bool rows_only = format == output_format::csv ||
+                     format == output_format::pgcopy_binary;
+    for (const auto &extra : extra_outputs) {
+        rows_only = rows_only && extra.format != output_format::flatgeobuf;
+    }
+    if (shard_count > 1 &&
+        (!state_dir.empty() || !update_dir.empty() || !diff_from.empty() ||
+         merge_lines || !rows_only)) {
+        std::cerr << "--shard/-P only works for full runs with csv or "
+                     "pgcopy-binary output,\n"
+                     "without --merge-lines/-m or --diff-from/-D.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (diff_from.empty() != sql_diff_file.empty()) {
+        std::cerr << "--diff-from/-D and --sql-diff/-s must be used "
+                     "together.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (!diff_from.empty() &&
+        (format != output_format::csv || !update_dir.empty())) {
+        std::cerr << "--diff-from/-D only works for full runs with csv "
+                     "output.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (compression_for(diff_from) != compression::none) {
+        std::cerr << "--diff-from/-D needs an uncompressed file.\n";
         std::exit(return_code_cmdline);
     }
 
@@ -90,19 +338,231 @@ Options::Options(int argc, char *argv[])
         std::exit(return_code_cmdline);
     }
 
+    // Two writers on the same file would overwrite each other
+    std::vector<std::string> files{output_file};
+    for (const double tolerance : simplify_tolerances) {
+        files.push_back(simplified_file_name(tolerance));
+    }
+    for (const auto &extra : extra_outputs) {
+        files.push_back(extra.file);
+    }
+    std::sort(files.begin(), files.end());
+    const auto same = std::adjacent_find(files.begin(), files.end());
+    if (same != files.end()) {
+        std::cerr << "Output file '" << *same
+                  << "' would be written more than once.\n";
+        std::exit(return_code_cmdline);
+    }
+
     inputfile = argv[optind];
 }
 
+bool Options::parse_extra_output(const char *text)
+{
+    const char *colon = std::strchr(text, ':');
+    if (!colon || colon[1] == '\0') {
+        return false;
+    }
+    extra_output extra;
+    // Vector tiles need their own zoom levels and tile sink
+    if (!parse_format(std::string(text, colon), extra.format) ||
+        extra.format == output_format::mvt) {
+        return false;
+    }
+    extra.file = colon + 1;
+    extra_outputs.push_back(extra);
+    return true;
+}
+
+std::string Options::simplified_file_name(double tolerance) const
+{
+    // The shortest fixed point form that reads back as the same number,
+    // so the names of different tolerances never collide
+    std::string number;
+    char buffer[512];
+    for (int decimals = 0; decimals < 350; ++decimals) {
+        std::snprintf(buffer, sizeof(buffer), "%.*f", decimals, tolerance);
+        number = buffer;
+        if (std::strtod(buffer, nullptr) == tolerance) {
+            break;
+        }
+    }
+    const std::string suffix = '-' + number;
+
+    std::string name = output_file;
+    std::string compressed;
+    if (compression_for(name) != compression::none) {
+        const size_t dot = name.find_last_of('.');
+        compressed = name.substr(dot);
+        name.erase(dot);
+    }
+
+    const size_t slash = name.find_last_of('/');
+    const size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos || dot == 0 ||
+        (slash != std::string::npos && dot <= slash + 1)) {
+        return name + suffix + compressed;
+    }
+    return name.substr(0, dot) + suffix + name.substr(dot) + compressed;
+}
+
+bool Options::parse_tolerances(const char *text)
+{
+    const char *p = text;
+    for (;;) {
+        char *end = nullptr;
+        const double tolerance = std::strtod(p, &end);
+        if (end == p || !(tolerance > 0.0) ||
+            std::find(simplify_tolerances.begin(), simplify_tolerances.end(),
+                      tolerance) != simplify_tolerances.end()) {
+            return false;
+        }
+        simplify_tolerances.push_back(tolerance);
+        if (*end == '\0') {
+            return true;
+        }
+        if (*end != ',') {
+            return false;
+        }
+        p = end + 1;
+    }
+}
+
+bool Options::parse_zoom_range(const char *text)
+{
+    char *end = nullptr;
+    const long min = std::strtol(text, &end, 10);
+    long max = min;
+    if (end == text) {
+        return false;
+    }
+    if (*end == '-') {
+        const char *p = end + 1;
+        max = std::strtol(p, &end, 10);
+        if (end == p) {
+            return false;
+        }
+    }
+    if (*end != '\0' || min < 0 || min > max || max > max_tile_zoom) {
+        return false;
+    }
+    min_zoom = static_cast<int>(min);
+    max_zoom = static_cast<int>(max);
+    return true;
+}
+
+bool Options::parse_bbox(const char *text)
+{
+    std::vector<double> values;
+    const char *p = text;
+    for (;;) {
+        char *end = nullptr;
+        values.push_back(std::strtod(p, &end));
+        if (end == p) {
+            return false;
+        }
+        if (*end == '\0') {
+            break;
+        }
+        if (*end != ',') {
+            return false;
+        }
+        p = end + 1;
+    }
+    if (values.size() != 4 || values[0] >= values[2] ||
+        values[1] >= values[3] || values[0] < -180.0 || values[2] > 180.0 ||
+        values[1] < -90.0 || values[3] > 90.0) {
+        return false;
+    }
+    bbox = values;
+    return true;
+}
+
+bool Options::parse_shard(const char *text)
+{
+    char *end = nullptr;
+    const long index = std::strtol(text, &end, 10);
+    if (end == text || *end != '/') {
+        return false;
+    }
+    const char *p = end + 1;
+    const long count = std::strtol(p, &end, 10);
+    if (end == p || *end != '\0' || index < 1 || index > count ||
+        count > 65536) {
+        return false;
+    }
+    shard_index = static_cast<unsigned int>(index - 1);
+    shard_count = static_cast<unsigned int>(count);
+    return true;
+}
+
 void Options::print_help() const
 {
     std::cout << "osmborder [OPTIONS] OSMFILE\n"
+              << "osmborder [OPTIONS] --update=DIR CHANGEFILE\n"
               << "\nOptions:\n"
               << "  -h, --help                 - This help message\n"
+              << "  -A, --also-output=FORMAT:FILE - Also write all lines "
+                 "to FILE in FORMAT\n"
+              << "                               (csv, pgcopy-binary or "
+                 "flatgeobuf)\n"
+              << "  -b, --bbox=MINLON,MINLAT,MAXLON,MAXLAT - Only write "
+                 "borders in this box\n"
+              << "  -B, --extract-buffer=DEG   - Keep nodes this far around "
+                 "the extract area\n"
+              << "                               (default: 0.1)\n"
+              << "  -C, --clip                 - Clip lines exactly to the "
+                 "extract area\n"
               << "  -d, --debug                - Enable debugging output\n"
+              << "  -D, --diff-from=FILE       - Compare with the csv output "
+                 "of an earlier run\n"
+              << "  -F, --format=FORMAT        - Output format: csv (default), "
+                 "pgcopy-binary,\n"
+              << "                               flatgeobuf or mvt\n"
               << "  -f, --overwrite            - Overwrite output file if it "
                  "already exists\n"
-              << "  -o, --output-file=FILE     - file for output\n"
+              << "  -I, --blob-index           - Index the blobs of PBF input "
+                 "and only read the\n"
+              << "                               ones each pass needs\n"
+              << "  -i, --index-type=TYPE      - Node location index "
+                 "(default: sparse_mem_array)\n"
+              << "  -j, --threads=NUM          - Number of threads for "
+                 "building linestrings\n"
+              << "                               (default: number of CPUs)\n"
+              << "  -J, --stats-json=FILE      - Write metrics for each pass "
+                 "to FILE as JSON\n"
+              << "  -m, --merge-lines          - Join ways with the same "
+                 "attributes into longer\n"
+              << "                               lines\n"
+              << "  -o, --output-file=FILE     - file for output, "
+                 "compressed if it ends in .gz\n"
+              << "                               or .zst\n"
+              << "  -p, --polygon=FILE         - Only write borders in the "
+                 "area of an Osmosis\n"
+              << "                               polygon file\n"
+              << "  -P, --shard=I/N            - Only handle the ways of "
+                 "shard I of N\n"
+              << "  -R, --rules=FILE           - Read the tag classification "
+                 "rules from FILE\n"
+              << "  -s, --sql-diff=FILE        - Write SQL to update the "
+                 "rows from --diff-from\n"
+              << "  -S, --state-dir=DIR        - Save state for later updates "
+                 "in DIR\n"
+              << "  -T, --simplify=TOLERANCES  - Also write lines simplified "
+                 "with each of\n"
+              << "                               these comma separated "
+                 "tolerances in meters\n"
+              << "  -u, --update=DIR           - Apply CHANGEFILE to the state "
+                 "in DIR and only\n"
+              << "                               write the lines that "
+                 "changed\n"
               << "  -v, --verbose              - Verbose output\n"
               << "  -V, --version              - Show version and exit\n"
+              << "  -X, --index-file=FILE      - Keep node locations in "
+                 "FILE and reuse them\n"
+              << "                               while the input doesn't "
+                 "change\n"
+              << "  -z, --zoom=MIN-MAX         - Zoom levels of the mvt "
+                 "tiles (default: 0-10)\n"
               << "\n";
 }
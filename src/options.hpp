@@ -23,6 +23,27 @@
 */
 
 #include <string>
+#include <vector>
+
+/// Formats osmborder can write its output in.
+enum class output_format
+{
+    /// Tab-delimited text with hex EWKB, for COPY ... FROM in text format
+    csv,
+    /// PostgreSQL binary COPY format with raw EWKB
+    pgcopy_binary,
+    /// FlatGeobuf with a spatial index
+    flatgeobuf,
+    /// Mapbox Vector Tiles in a directory or MBTiles file
+    mvt
+};
+
+/// An extra output written from the same run as the main one.
+struct extra_output
+{
+    output_format format;
+    std::string file;
+};
 
 /**
  * This class encapsulates the command line parsing.
@@ -40,6 +61,12 @@ public:
     /// Output file name.
     std::string output_file;
 
+    /// Output file format.
+    output_format format;
+
+    /// Further outputs with all lines in other formats.
+    std::vector<extra_output> extra_outputs;
+
     /// Should output database be overwritten
     bool overwrite_output;
 
@@ -49,8 +76,72 @@ public:
     /// Verbose output?
     bool verbose;
 
+    /// Join ways with the same attributes into longer lines?
+    bool merge_lines;
+
+    /// Tolerances for the extra simplified outputs.
+    std::vector<double> simplify_tolerances;
+
+    /// Zoom levels to write vector tiles for.
+    int min_zoom;
+    int max_zoom;
+
+    /// Area of a regional extract as MINLON, MINLAT, MAXLON, MAXLAT, if any.
+    std::vector<double> bbox;
+
+    /// Osmosis polygon file with the area of a regional extract, if any.
+    std::string polygon_file;
+
+    /// Degrees around the extract area in which nodes are kept.
+    double extract_buffer;
+
+    /// Clip the lines of an extract exactly to its area?
+    bool clip;
+
+    /// Only handle shard shard_index (from 0) of shard_count.
+    unsigned int shard_index;
+    unsigned int shard_count;
+
+    /// Read only the relevant parts of PBF input using a blob index?
+    bool blob_index;
+
+    /// Type of the node location index, as known to libosmium.
+    std::string index_type;
+
+    /// File to keep the node locations in for later runs, if any.
+    std::string index_file;
+
+    /// Number of threads used to build linestrings.
+    unsigned int threads;
+
+    /// Directory to save the state for later updates in, if any.
+    std::string state_dir;
+
+    /// State directory to update from a change file, if in update mode.
+    std::string update_dir;
+
+    /// Output of an earlier run to compare with, if any.
+    std::string diff_from;
+
+    /// File for the SQL to get from the earlier output to this one.
+    std::string sql_diff_file;
+
+    /// File to write the metrics of the run to as JSON, if any.
+    std::string stats_json;
+
+    /// File with the tag classification rules, if not the built-in ones.
+    std::string rules_file;
+
     Options(int argc, char *argv[]);
 
+    /**
+     * File name for the lines simplified with the given tolerance, which
+     * is added to the name of the main output before its extension, such
+     * as "lines-1000.csv" for "lines.csv" or "lines-1000.csv.gz" for
+     * "lines.csv.gz". Different tolerances always give different names.
+     */
+    std::string simplified_file_name(double tolerance) const;
+
 private:
     /**
      * Get EPSG code from text. This method knows about a few common cases
@@ -59,6 +150,37 @@ private:
      */
     int get_epsg(const char *text);
 
+    /**
+     * Add the tolerances from a comma separated list to
+     * simplify_tolerances. Returns false if it isn't a list of positive
+     * numbers or has a tolerance that was already given.
+     */
+    bool parse_tolerances(const char *text);
+
+    /**
+     * Add an extra output from "FORMAT:FILE". Returns false if that isn't
+     * a known format and a file name.
+     */
+    bool parse_extra_output(const char *text);
+
+    /**
+     * Set min_zoom and max_zoom from "MIN-MAX" or a single zoom level.
+     * Returns false if that isn't a valid range.
+     */
+    bool parse_zoom_range(const char *text);
+
+    /**
+     * Set bbox from "MINLON,MINLAT,MAXLON,MAXLAT". Returns false if that
+     * isn't a valid box.
+     */
+    bool parse_bbox(const char *text);
+
+    /**
+     * Set shard_index and shard_count from "I/N", with I counted from 1.
+     * Returns false if that isn't a valid shard.
+     */
+    bool parse_shard(const char *text);
+
     void print_help() const;
 
 }; // class Options
@@ -21,8 +21,20 @@
 */
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #ifndef _MSC_VER
 #include <unistd.h>
@@ -41,6 +53,13 @@
 #include <osmium/util/verbose_output.hpp>
 #include <osmium/visitor.hpp>
 
+// For LIBOSMIUM_VERSION_CODE, which older versions don't have
+#if defined(__has_include)
+#if __has_include(<osmium/version.hpp>)
+#include <osmium/version.hpp>
+#endif
+#endif
+
 namespace osmium {
 class Area;
 }
@@ -55,9 +74,25 @@ class Way;
 }
 
 #include "adminhandler.hpp"
+#include "blobindex.hpp"
+#include "compactmap.hpp"
+#include "extract.hpp"
+#include "idset.hpp"
+#include "linesink.hpp"
+#include "linewriter.hpp"
+#include "mvt.hpp"
 #include "options.hpp"
+#include "output.hpp"
 #include "return_codes.hpp"
+#include "rowdiff.hpp"
+#include "state.hpp"
 #include "stats.hpp"
+#include "tagrules.hpp"
+#include "update.hpp"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 // Global debug marker
 bool debug;
@@ -78,37 +113,285 @@ std::string memory_usage()
 
 /* ================================================== */
 
-// This class acts like NodeLocationsForWays but only stores specific nodes
-// Also, only positive. TODO: Add in negative support
-template <typename TStoragePosIDs>
+// This class acts like NodeLocationsForWays but only stores specific nodes,
+// the ones referenced by the ways kept in pass 2. Positive and negative IDs
+// go into separate storage, as with NodeLocationsForWays.
+template <typename TStoragePosIDs, typename TStorageNegIDs>
 class SpecificNodeLocationsForWays
-    : public osmium::handler::NodeLocationsForWays<TStoragePosIDs>
+    : public osmium::handler::NodeLocationsForWays<TStoragePosIDs,
+                                                   TStorageNegIDs>
 {
+    typedef osmium::handler::NodeLocationsForWays<TStoragePosIDs,
+                                                  TStorageNegIDs>
+        base_type;
+
+    // IDs of the nodes to keep
+    const IdSet &m_node_ids;
+    // Area of an extract, nodes outside it aren't kept
+    const ExtractArea *m_area;
+    uint64_t m_nodes_seen = 0;
+    uint64_t m_nodes_kept = 0;
 
-    // some var for a set of IDs to keep
 public:
-    explicit SpecificNodeLocationsForWays(TStoragePosIDs &storage_pos)
-    : osmium::handler::NodeLocationsForWays<TStoragePosIDs>(storage_pos)
+    SpecificNodeLocationsForWays(TStoragePosIDs &storage_pos,
+                                 TStorageNegIDs &storage_neg,
+                                 const IdSet &node_ids,
+                                 const ExtractArea *area = nullptr)
+    : base_type(storage_pos, storage_neg), m_node_ids(node_ids), m_area(area)
     {
     }
 
     void node(const osmium::Node &node)
     {
-        if (true) {
-            osmium::handler::NodeLocationsForWays<TStoragePosIDs>::node(node);
+        ++m_nodes_seen;
+        if (m_node_ids.get(node.id()) &&
+            (m_area == nullptr || m_area->keep(node.location()))) {
+            ++m_nodes_kept;
+            base_type::node(node);
         }
     }
-    void way(osmium::Way &way)
-    {
-        osmium::handler::NodeLocationsForWays<TStoragePosIDs>::way(way);
-    }
+    void way(osmium::Way &way) { base_type::way(way); }
+
+    uint64_t nodes_seen() const { return m_nodes_seen; }
+    uint64_t nodes_kept() const { return m_nodes_kept; }
 };
 
-// TODO: Cover all admin_levels
-// This is a map instead of something like an array of chars because admin_levels can extend past 9
-const std::map<std::string, const int> AdminHandler::admin_levels = {
-    {"2", 2}, {"3", 3}, {"4", 4},   {"5", 5},   {"6", 6},  {"7", 7},
-    {"8", 8}, {"9", 9}, {"10", 10}, {"11", 11}, {"12", 12}};
+/// Size of a file, or 0 if it can't be found out, such as for stdin.
+uint64_t file_size(const std::string &filename)
+{
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+/// Modification time of a file, or -1 if it doesn't exist.
+int64_t file_mtime(const std::string &filename)
+{
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0) {
+        return -1;
+    }
+    return static_cast<int64_t>(st.st_mtime);
+}
+
+typedef osmium::index::map::Map<osmium::unsigned_object_id_type,
+                                osmium::Location>
+    location_index_type;
+
+/**
+ * What the node locations saved with --index-file depend on: the size and
+ * modification time of the input, the rules, which decide the border
+ * ways, and the shard. It is saved with ".key" appended to the index file
+ * name. Returns an empty string if the input isn't a regular file.
+ */
+std::string index_key(const Options &options)
+{
+    const int64_t mtime = file_mtime(options.inputfile);
+    if (mtime < 0) {
+        return std::string();
+    }
+    std::ostringstream key;
+    key << "osmborder node index 1\n"
+        << "input " << file_size(options.inputfile) << ' ' << mtime << '\n';
+    if (options.rules_file.empty()) {
+        key << "rules built-in\n";
+    } else {
+        // FNV-1a of the rules file
+        std::ifstream in(options.rules_file, std::ios::binary);
+        uint64_t hash = 14695981039346656037ull;
+        char c;
+        while (in.get(c)) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        key << "rules " << std::hex << hash << std::dec << '\n';
+    }
+    key << "shard " << options.shard_index << '/' << options.shard_count
+        << '\n';
+    return key.str();
+}
+
+/**
+ * Can the node locations saved with --index-file be used for this run?
+ * They can if both index files exist and were saved with the same key.
+ */
+bool index_file_usable(const std::string &index_file, const std::string &key)
+{
+    if (key.empty() || file_mtime(index_file) < 0 ||
+        file_mtime(index_file + ".neg") < 0) {
+        return false;
+    }
+    std::ifstream in(index_file + ".key", std::ios::binary);
+    const std::string saved((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+    return saved == key;
+}
+
+/// Save the key of the index files, once they are complete.
+void save_index_key(const std::string &index_file, const std::string &key)
+{
+    const std::string filename = index_file + ".key";
+    const std::string tmp_filename = filename + ".tmp";
+    std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+    out << key;
+    out.close();
+    if (out.fail() ||
+        std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp_filename.c_str());
+        throw std::runtime_error{"Can't save '" + filename + "'"};
+    }
+}
+
+/**
+ * Save a node location index as a sorted list of IDs and locations, which
+ * is the format of the sparse_file_array index. The file is written under
+ * a temporary name first, so a half written one is never reused.
+ */
+void save_index(location_index_type &index, const std::string &filename)
+{
+    const std::string tmp_filename = filename + ".tmp";
+    const int fd = ::open(tmp_filename.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can't open '" + tmp_filename + "'"};
+    }
+    try {
+        index.sort();
+        index.dump_as_list(fd);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd) != 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can't write '" + tmp_filename + "'"};
+    }
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Can't rename '" + tmp_filename + "'"};
+    }
+}
+
+/**
+ * Note how much input a pass read: the selected blobs if there is a blob
+ * index, otherwise what the reader got from the file.
+ */
+void set_input_read(PassStats &pass, const BlobSource *blobs,
+                    const osmium::io::Reader &reader,
+                    const std::string &filename)
+{
+    if (blobs) {
+        pass.bytes_read = blobs->size();
+        pass.blobs_read = static_cast<int64_t>(blobs->num_blobs());
+        return;
+    }
+#if defined(LIBOSMIUM_VERSION_CODE) && LIBOSMIUM_VERSION_CODE >= 2014000
+    // Also right for stdin
+    pass.bytes_read = reader.offset();
+#else
+    // Older versions can't tell, but they always read the whole file
+    (void)reader;
+    pass.bytes_read = file_size(filename);
+#endif
+}
+
+/**
+ * Write the metrics to the --stats-json file if there is one. Returns
+ * false if that fails.
+ */
+bool write_stats(const Options &options, const Stats &stats,
+                 unsigned int warnings, unsigned int errors)
+{
+    if (options.stats_json.empty()) {
+        return true;
+    }
+    std::ofstream out(options.stats_json);
+    stats.write_json(out, warnings, errors);
+    out.close();
+    if (!out) {
+        std::cerr << "Error writing '" << options.stats_json << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Check if the input has the node locations on its ways. This is the
+ * LocationsOnWays optional feature of PBF files.
+ */
+bool has_locations_on_ways(const osmium::io::File &infile)
+{
+    osmium::io::Reader reader(infile, osmium::osm_entity_bits::nothing);
+    const osmium::io::Header header = reader.header();
+    reader.close();
+
+    for (int i = 0;; ++i) {
+        const std::string feature =
+            header.get("pbf_optional_feature_" + std::to_string(i));
+        if (feature.empty()) {
+            return false;
+        }
+        if (feature == "LocationsOnWays") {
+            return true;
+        }
+    }
+}
+
+/**
+ * Apply a change file to the saved state and write the lines of the ways
+ * that changed. The IDs of all those ways, including the ones that aren't
+ * border ways any more, go into a second file with ".delete" appended to
+ * the output file name. Returns the number of warnings.
+ */
+unsigned int update(const Options &options, const TagRules &rules,
+                    OutputWriter &output, Stats &stats,
+                    osmium::util::VerboseOutput &vout)
+{
+    stats.start_pass("load_state");
+    BorderState state;
+    vout << "Loading state from '" << options.update_dir << "'.\n";
+    state.load(options.update_dir);
+    vout << "State has " << state.relations().size() << " relations, "
+         << state.ways().size() << " ways and " << state.num_nodes()
+         << " nodes.\n";
+    stats.pass().objects_kept = state.ways().size();
+    stats.end_pass();
+
+    vout << "Applying changes from '" << options.inputfile << "'.\n";
+    stats.start_pass("apply_changes").bytes_read =
+        file_size(options.inputfile);
+    StateUpdater updater(state, rules);
+    updater.apply(osmium::io::File{options.inputfile});
+    vout << updater.affected_ways().size() << " ways changed.\n";
+    stats.pass().objects_kept = updater.affected_ways().size();
+    stats.end_pass();
+
+    stats.start_pass("linestrings");
+    LineWriter writer(make_line_sink(output, options.format));
+    writer.begin();
+    updater.write_lines(writer, stats.geometry_errors());
+    writer.finish();
+    stats.pass().objects_seen = updater.affected_ways().size();
+    stats.end_pass();
+    vout << stats.geometry_errors().total() << " ways had geometry errors.\n";
+
+    OutputWriter deleted(options.output_file + ".delete");
+    std::string ids;
+    for (const auto id : updater.affected_ways()) {
+        append_int(ids, id);
+        ids += '\n';
+    }
+    deleted.write(std::move(ids));
+    deleted.close();
+
+    vout << "Saving state.\n";
+    state.save(options.update_dir);
+    vout << memory_usage();
+
+    return updater.warnings();
+}
 
 int main(int argc, char *argv[])
 {
@@ -126,44 +409,370 @@ int main(int argc, char *argv[])
 
     debug = options.debug;
 
-    vout << "Writing to file '" << options.output_file << "'.\n";
+    osmium::io::File infile{argv[optind]};
 
-    std::ofstream output(options.output_file);
+    TagRules rules;
+    if (!options.rules_file.empty()) {
+        vout << "Reading rules from '" << options.rules_file << "'.\n";
+        try {
+            rules.load(options.rules_file);
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            return return_code_fatal;
+        }
+    }
 
-    osmium::io::File infile{argv[optind]};
+    std::unique_ptr<ExtractArea> area;
+    if (!options.bbox.empty()) {
+        const auto &b = options.bbox;
+        area.reset(
+            new ExtractArea(b[0], b[1], b[2], b[3], options.extract_buffer));
+    } else if (!options.polygon_file.empty()) {
+        vout << "Reading extract area from '" << options.polygon_file
+             << "'.\n";
+        try {
+            area.reset(
+                new ExtractArea(options.polygon_file, options.extract_buffer));
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            return return_code_fatal;
+        }
+    }
+
+    std::unique_ptr<OutputWriter> output;
+    std::unique_ptr<mvt::TileSink> tile_sink;
+    try {
+        if (options.format == output_format::mvt) {
+            vout << "Writing zoom " << options.min_zoom << " to "
+                 << options.max_zoom << " tiles to '" << options.output_file
+                 << "'.\n";
+            tile_sink = mvt::open_sink(options.output_file, options.min_zoom,
+                                       options.max_zoom);
+        } else {
+            vout << "Writing to file '" << options.output_file << "'.\n";
+            output.reset(
+                new OutputWriter(options.output_file, options.threads));
+        }
+    } catch (const std::runtime_error &e) {
+        // Includes std::system_error from opening the output
+        std::cerr << e.what() << "\n";
+        return return_code_fatal;
+    }
+
+    if (!options.update_dir.empty()) {
+        try {
+            warnings += update(options, rules, *output, stats, vout);
+            output->close();
+        } catch (const std::runtime_error &e) {
+            // Includes std::system_error from writing the output
+            std::cerr << e.what() << "\n";
+            return return_code_fatal;
+        }
+        if (!write_stats(options, stats, warnings, errors)) {
+            return return_code_fatal;
+        }
+        std::cerr << "There were " << warnings << " warnings.\n";
+        return warnings > max_warnings
+                   ? return_code_error
+                   : (warnings ? return_code_warning : return_code_ok);
+    }
+
+    // Table the SQL diff applies to
+    const std::string table_name = "osmborder_lines";
+    std::unique_ptr<RowDiff> diff;
+    if (!options.diff_from.empty()) {
+        vout << "Reading earlier output from '" << options.diff_from
+             << "'.\n";
+        try {
+            diff.reset(new RowDiff(options.diff_from));
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            return return_code_fatal;
+        }
+    }
 
-    AdminHandler admin_handler(output);
+    BlobIndex blob_index;
+    if (options.blob_index) {
+        vout << "Opening blob index for '" << options.inputfile << "'.\n";
+        stats.start_pass("blob_index");
+        try {
+            if (!blob_index.open(options.inputfile, options.threads)) {
+                std::cerr << "Warning: --blob-index only works for PBF "
+                             "files, and not on Windows.\n";
+                ++warnings;
+            } else if (!blob_index.loaded()) {
+                vout << "Built index of " << blob_index.blobs().size()
+                     << " blobs.\n";
+            }
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            return return_code_fatal;
+        }
+        // Building the index reads the whole input, loading it only the
+        // saved index
+        stats.pass().bytes_read =
+            blob_index.loaded() ? file_size(options.inputfile + ".blobidx")
+                                : file_size(options.inputfile);
+        stats.pass().objects_kept = blob_index.blobs().size();
+        stats.pass().index_bytes =
+            blob_index.blobs().size() * sizeof(BlobIndex::blob);
+        stats.end_pass();
+    }
+
+    // The node location index is made up front, so a wrong type is
+    // reported before the long passes.
+    CompactLocationMap::register_type();
+    const auto &map_factory = osmium::index::MapFactory<
+        osmium::unsigned_object_id_type, osmium::Location>::instance();
+    const bool reuse_index =
+        !options.index_file.empty() &&
+        index_file_usable(options.index_file, index_key(options));
+    std::unique_ptr<location_index_type> index_pos;
+    std::unique_ptr<location_index_type> index_neg;
+    try {
+        if (reuse_index) {
+            index_pos = map_factory.create_map("sparse_file_array," +
+                                               options.index_file);
+            index_neg = map_factory.create_map("sparse_file_array," +
+                                               options.index_file + ".neg");
+        } else {
+            index_pos = map_factory.create_map(options.index_type);
+            // Negative IDs don't occur in OSM data, so a small sparse index
+            // is enough for them whatever the type for the others
+            index_neg = map_factory.create_map("sparse_mem_array");
+        }
+    } catch (const std::runtime_error &e) {
+        // Includes osmium::map_factory_error for unknown types
+        std::cerr << e.what() << "\nAvailable index types:";
+        for (const auto &type : map_factory.map_types()) {
+            std::cerr << ' ' << type;
+        }
+        std::cerr << "\n";
+        return return_code_fatal;
+    }
+
+    std::unique_ptr<mvt::TileSet> tiles;
+    std::unique_ptr<AdminHandler> handler;
+    if (tile_sink) {
+        tiles.reset(new mvt::TileSet(*tile_sink, options.min_zoom,
+                                     options.max_zoom, options.threads));
+        handler.reset(new AdminHandler(rules, *tiles, options.merge_lines));
+    } else {
+        handler.reset(new AdminHandler(rules, *output, options.format,
+                                       options.merge_lines, diff.get()));
+    }
+    AdminHandler &admin_handler = *handler;
+    std::vector<std::unique_ptr<OutputWriter>> simplified_outputs;
+    for (const double tolerance : options.simplify_tolerances) {
+        const std::string filename =
+            options.simplified_file_name(tolerance);
+        vout << "Writing lines simplified with tolerance " << tolerance
+             << " to '" << filename << "'.\n";
+        try {
+            simplified_outputs.emplace_back(
+                new OutputWriter(filename, options.threads));
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            return return_code_fatal;
+        }
+        admin_handler.add_simplified_output(*simplified_outputs.back(),
+                                            options.format, tolerance);
+    }
+    std::vector<std::unique_ptr<OutputWriter>> extra_outputs;
+    for (const auto &extra : options.extra_outputs) {
+        vout << "Also writing to file '" << extra.file << "'.\n";
+        try {
+            extra_outputs.emplace_back(
+                new OutputWriter(extra.file, options.threads));
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            return return_code_fatal;
+        }
+        admin_handler.add_output(*extra_outputs.back(), extra.format);
+    }
+    BorderState state;
+    if (!options.state_dir.empty()) {
+        admin_handler.keep_state(state);
+    }
+    if (area) {
+        admin_handler.set_extract(*area, options.clip);
+    }
 
     {
         vout << "Reading relations in pass 1.\n";
-        osmium::io::Reader reader(infile, osmium::osm_entity_bits::relation);
+        PassStats &pass = stats.start_pass("relations");
+        const auto blobs =
+            blob_index.select(osmium::osm_entity_bits::relation);
+        osmium::io::Reader reader(blobs ? blobs->file() : infile,
+                                  osmium::osm_entity_bits::relation);
         osmium::apply(reader, admin_handler);
         reader.close();
+        admin_handler.prepare_way_levels();
+        vout << "Relations reference "
+             << admin_handler.get_way_levels().size() << " ways.\n";
+        if (options.shard_count > 1) {
+            const size_t ways = admin_handler.restrict_to_shard(
+                options.shard_index, options.shard_count);
+            vout << "Shard " << options.shard_index + 1 << " of "
+                 << options.shard_count << " has " << ways << " ways.\n";
+        }
         vout << memory_usage();
+        set_input_read(pass, blobs.get(), reader, options.inputfile);
+        pass.objects_seen = admin_handler.relations_seen();
+        pass.objects_kept = admin_handler.relations_kept();
+        pass.index_bytes = admin_handler.get_way_levels().used_memory() +
+                           admin_handler.get_way_ids().used_memory();
+        stats.end_pass();
     }
+    // Files written by osmborder_filter --add-locations already have the
+    // node locations on the ways, so there's no need for a node pass.
+    const bool locations_on_ways = has_locations_on_ways(infile);
+    // Nor when the locations from an earlier run can be reused.
+    admin_handler.m_handler_pass2.collect_node_ids(!locations_on_ways &&
+                                                   !reuse_index);
     {
         vout << "Reading ways pass 2.\n";
-        osmium::io::Reader reader(infile, osmium::osm_entity_bits::way);
+        PassStats &pass = stats.start_pass("ways");
+        const auto blobs = blob_index.select(osmium::osm_entity_bits::way,
+                                             &admin_handler.get_way_ids());
+        osmium::io::Reader reader(blobs ? blobs->file() : infile,
+                                  osmium::osm_entity_bits::way);
         osmium::apply(reader, admin_handler.m_handler_pass2);
         reader.close();
         vout << memory_usage();
+        set_input_read(pass, blobs.get(), reader, options.inputfile);
+        pass.objects_seen = admin_handler.m_handler_pass2.m_ways_seen;
+        pass.objects_kept = admin_handler.m_handler_pass2.m_ways_kept;
+        pass.index_bytes = admin_handler.get_ways().committed() +
+                           admin_handler.get_node_ids().used_memory();
+        stats.end_pass();
     }
-    typedef osmium::index::map::SparseMemArray<osmium::unsigned_object_id_type,
-                                                osmium::Location>
-        index_type;
-    typedef SpecificNodeLocationsForWays<index_type> location_handler_type;
-    index_type index;
-    location_handler_type location_handler{index};
-    {
-        vout << "Reading nodes pass 3.\n";
-        osmium::io::Reader reader(infile, osmium::osm_entity_bits::node);
+    if (locations_on_ways) {
+        vout << "Input has node locations on ways, skipping node pass.\n";
+    } else if (reuse_index) {
+        vout << "Reusing node locations from '" << options.index_file
+             << "', skipping node pass.\n";
+        typedef SpecificNodeLocationsForWays<location_index_type,
+                                             location_index_type>
+            location_handler_type;
+        location_handler_type location_handler{*index_pos, *index_neg,
+                                               admin_handler.get_node_ids()};
+        location_handler.ignore_errors();
+        osmium::apply(admin_handler.get_ways(), location_handler);
+    } else {
+        vout << "Ways reference " << admin_handler.get_node_ids().size()
+             << " nodes.\n";
+
+        typedef SpecificNodeLocationsForWays<location_index_type,
+                                             location_index_type>
+            location_handler_type;
+        location_handler_type location_handler{*index_pos, *index_neg,
+                                               admin_handler.get_node_ids(),
+                                               area.get()};
+        // Ways with missing nodes are reported when building linestrings
+        location_handler.ignore_errors();
+
+        vout << "Reading nodes pass 3 into a " << options.index_type
+             << " index.\n";
+        PassStats &pass = stats.start_pass("nodes");
+        const auto blobs = blob_index.select(osmium::osm_entity_bits::node,
+                                             &admin_handler.get_node_ids());
+        osmium::io::Reader reader(blobs ? blobs->file() : infile,
+                                  osmium::osm_entity_bits::node);
         osmium::apply(reader, location_handler);
         reader.close();
+        vout << "Stored " << index_pos->size() + index_neg->size()
+             << " node locations.\n";
         vout << memory_usage();
+
+        // The ways we need are all in the buffer from pass 2, so there is no
+        // need to read the input again.
+        osmium::apply(admin_handler.get_ways(), location_handler);
+        set_input_read(pass, blobs.get(), reader, options.inputfile);
+        pass.objects_seen = location_handler.nodes_seen();
+        pass.objects_kept = location_handler.nodes_kept();
+        pass.index_bytes =
+            index_pos->used_memory() + index_neg->used_memory();
+        stats.end_pass();
+
+        if (!options.index_file.empty()) {
+            vout << "Saving node locations to '" << options.index_file
+                 << "'.\n";
+            try {
+                const std::string key = index_key(options);
+                // The old key is removed first and the new one saved last,
+                // so index files that are only partly replaced aren't used
+                std::remove((options.index_file + ".key").c_str());
+                save_index(*index_neg, options.index_file + ".neg");
+                save_index(*index_pos, options.index_file);
+                if (!key.empty()) {
+                    save_index_key(options.index_file, key);
+                }
+            } catch (const std::runtime_error &e) {
+                std::cerr << "Warning: " << e.what() << "\n";
+                ++warnings;
+            }
+        }
+    }
+
+    vout << "Building linestrings with " << options.threads
+         << " threads.\n";
+    stats.start_pass("linestrings");
+    try {
+        admin_handler.build_linestrings(options.threads);
+        if (output) {
+            output->close();
+        }
+        if (tile_sink) {
+            tile_sink->close();
+            vout << "Wrote " << tiles->tiles() << " tiles.\n";
+        }
+        for (auto &simplified : simplified_outputs) {
+            simplified->close();
+        }
+        for (auto &extra : extra_outputs) {
+            extra->close();
+        }
+        if (diff) {
+            vout << "Writing SQL diff to '" << options.sql_diff_file
+                 << "'.\n";
+            OutputWriter sql(options.sql_diff_file);
+            diff->write_sql(sql, table_name);
+            sql.close();
+            vout << "Diff deletes " << diff->deleted() << " rows and inserts "
+                 << diff->inserted() << " rows.\n";
+        }
+    } catch (const std::runtime_error &e) {
+        std::cerr << "Error writing output: " << e.what() << "\n";
+        return return_code_fatal;
+    }
+    stats.pass().objects_seen = admin_handler.m_handler_pass2.m_ways_kept;
+    stats.pass().objects_kept = admin_handler.lines_written();
+    stats.end_pass();
+
+    // Broken boundaries are common in extracts, so they only go into the
+    // stats and don't change the exit code
+    stats.geometry_errors() += admin_handler.geometry_errors();
+    vout << stats.geometry_errors().total() << " ways had geometry errors.\n";
+
+    if (!options.state_dir.empty()) {
+        vout << "Saving state to '" << options.state_dir << "'.\n";
+        stats.start_pass("save_state");
+        admin_handler.fill_state();
+        try {
+            state.save(options.state_dir);
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            return return_code_fatal;
+        }
+        stats.pass().objects_kept = state.ways().size();
+        stats.end_pass();
+        vout << memory_usage();
+    }
+
+    if (!write_stats(options, stats, warnings, errors)) {
+        ++errors;
     }
-    vout << "Building linestrings.\n";
-    osmium::io::Reader reader(infile, osmium::osm_entity_bits::way);
-    osmium::apply(reader, location_handler, admin_handler);
 
     vout << "All done.\n";
     vout << memory_usage();
@@ -0,0 +1,704 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/io/any_output.hpp>
+#include <osmium/io/file.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+
+#include "return_codes.hpp"
+
+/*
+ * Benchmark for osmborder and osmborder_filter. A synthetic OSM file with
+ * boundary relations is generated, then both programs are run on it with
+ * verbose output. The start of each pass is taken from the time its
+ * message arrives, and the results are written as JSON.
+ */
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+double seconds_since(clock_type::time_point start,
+                     clock_type::time_point end = clock_type::now())
+{
+    return std::chrono::duration<double>(end - start).count();
+}
+
+/// Size of the synthetic data.
+struct parameters
+{
+    unsigned int relations = 1000;
+    unsigned int ways_per_relation = 20;
+    unsigned int nodes_per_way = 50;
+    /// Difference between consecutive IDs of each type
+    unsigned int id_sparsity = 1;
+    /// Ways and nodes per relation that aren't part of any border
+    unsigned int extra_ways_per_relation = 20;
+};
+
+/// Number of objects written by the generator.
+struct generated
+{
+    uint64_t nodes = 0;
+    uint64_t ways = 0;
+    uint64_t relations = 0;
+    uint64_t border_ways = 0;
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+};
+
+/**
+ * Writes a PBF file with one boundary relation per cell of a grid over the
+ * world. Each relation is a ring of closed-up ways that share their end
+ * nodes, and each cell also gets some other ways the filter has to drop.
+ * IDs go up by id_sparsity, and everything is written in the order a PBF
+ * file is expected to be in.
+ */
+class Generator
+{
+    // Write out the buffer once it holds this much
+    static constexpr size_t flush_size = 8 * 1024 * 1024;
+
+    const parameters &m_params;
+    const unsigned int m_columns;
+    const unsigned int m_rows;
+    // Nodes on the ring of each relation
+    const uint64_t m_ring_nodes;
+    const uint64_t m_nodes_per_relation;
+    const uint64_t m_ways_per_relation;
+
+    osmium::object_id_type id(uint64_t index) const
+    {
+        return static_cast<osmium::object_id_type>(
+            1 + index * m_params.id_sparsity);
+    }
+
+    osmium::object_id_type ring_node_id(unsigned int relation,
+                                        uint64_t k) const
+    {
+        return id(relation * m_nodes_per_relation + k % m_ring_nodes);
+    }
+
+    osmium::object_id_type extra_node_id(unsigned int relation,
+                                         unsigned int way,
+                                         unsigned int node) const
+    {
+        return id(relation * m_nodes_per_relation + m_ring_nodes +
+                  uint64_t(way) * m_params.nodes_per_way + node);
+    }
+
+    void cell(unsigned int relation, double &x, double &y, double &radius) const
+    {
+        const double width = 340.0 / m_columns;
+        const double height = 160.0 / m_rows;
+        x = -170.0 + (relation % m_columns + 0.5) * width;
+        y = -80.0 + (relation / m_columns + 0.5) * height;
+        radius = 0.4 * std::min(width, height);
+    }
+
+    static void flush(osmium::io::Writer &writer,
+                      osmium::memory::Buffer &buffer, bool force = false)
+    {
+        if (buffer.committed() > flush_size || (force && buffer.committed())) {
+            writer(std::move(buffer));
+            buffer = osmium::memory::Buffer{
+                2 * flush_size, osmium::memory::Buffer::auto_grow::yes};
+        }
+    }
+
+public:
+    explicit Generator(const parameters &params)
+    : m_params(params),
+      m_columns(static_cast<unsigned int>(
+          std::ceil(std::sqrt(static_cast<double>(params.relations))))),
+      m_rows((params.relations + m_columns - 1) / m_columns),
+      m_ring_nodes(uint64_t(params.ways_per_relation) *
+                   (params.nodes_per_way - 1)),
+      m_nodes_per_relation(m_ring_nodes +
+                           uint64_t(params.extra_ways_per_relation) *
+                               params.nodes_per_way),
+      m_ways_per_relation(uint64_t(params.ways_per_relation) +
+                          params.extra_ways_per_relation)
+    {
+    }
+
+    generated write(const std::string &filename) const
+    {
+        using namespace osmium::builder::attr;
+
+        const auto start = clock_type::now();
+        generated counts;
+
+        osmium::io::Header header;
+        header.set("generator", "osmborder_bench");
+        header.add_box(osmium::Box{-180.0, -90.0, 180.0, 90.0});
+        osmium::io::Writer writer{osmium::io::File{filename, "pbf"}, header,
+                                  osmium::io::overwrite::allow};
+        osmium::memory::Buffer buffer{2 * flush_size,
+                                      osmium::memory::Buffer::auto_grow::yes};
+
+        const double pi = std::acos(-1.0);
+        for (unsigned int r = 0; r < m_params.relations; ++r) {
+            double x;
+            double y;
+            double radius;
+            cell(r, x, y, radius);
+            for (uint64_t k = 0; k < m_ring_nodes; ++k) {
+                const double angle = 2 * pi * k / m_ring_nodes;
+                osmium::builder::add_node(
+                    buffer, _id(ring_node_id(r, k)), _version(1),
+                    _location(x + radius * std::cos(angle),
+                              y + radius * std::sin(angle)));
+            }
+            for (unsigned int w = 0; w < m_params.extra_ways_per_relation;
+                 ++w) {
+                // Spokes inside the ring
+                const double angle =
+                    2 * pi * w / m_params.extra_ways_per_relation;
+                for (unsigned int n = 0; n < m_params.nodes_per_way; ++n) {
+                    const double d = 0.5 * radius * n / m_params.nodes_per_way;
+                    osmium::builder::add_node(
+                        buffer, _id(extra_node_id(r, w, n)), _version(1),
+                        _location(x + d * std::cos(angle),
+                                  y + d * std::sin(angle)));
+                }
+            }
+            counts.nodes += m_nodes_per_relation;
+            flush(writer, buffer);
+        }
+
+        std::vector<osmium::object_id_type> nodes;
+        for (unsigned int r = 0; r < m_params.relations; ++r) {
+            const uint64_t first_way = r * m_ways_per_relation;
+            for (unsigned int w = 0; w < m_params.ways_per_relation; ++w) {
+                nodes.clear();
+                const uint64_t first = uint64_t(w) * (m_params.nodes_per_way - 1);
+                for (unsigned int n = 0; n < m_params.nodes_per_way; ++n) {
+                    nodes.push_back(ring_node_id(r, first + n));
+                }
+                // Every fifth relation has one maritime way
+                const bool maritime = r % 5 == 0 && w == 0;
+                osmium::builder::add_way(
+                    buffer, _id(id(first_way + w)), _version(1),
+                    _nodes(nodes), _tag("boundary", "administrative"),
+                    _tag("maritime", maritime ? "yes" : "no"));
+            }
+            for (unsigned int w = 0; w < m_params.extra_ways_per_relation;
+                 ++w) {
+                nodes.clear();
+                for (unsigned int n = 0; n < m_params.nodes_per_way; ++n) {
+                    nodes.push_back(extra_node_id(r, w, n));
+                }
+                osmium::builder::add_way(
+                    buffer,
+                    _id(id(first_way + m_params.ways_per_relation + w)),
+                    _version(1), _nodes(nodes),
+                    _tag("highway", "residential"));
+            }
+            counts.ways += m_ways_per_relation;
+            counts.border_ways += m_params.ways_per_relation;
+            flush(writer, buffer);
+        }
+
+        std::vector<member_type> members;
+        for (unsigned int r = 0; r < m_params.relations; ++r) {
+            members.clear();
+            const uint64_t first_way = r * m_ways_per_relation;
+            for (unsigned int w = 0; w < m_params.ways_per_relation; ++w) {
+                members.emplace_back(osmium::item_type::way,
+                                     id(first_way + w), "outer");
+            }
+            const std::string admin_level = std::to_string(2 + r % 9);
+            osmium::builder::add_relation(
+                buffer, _id(id(r)), _version(1), _members(members),
+                _tag("type", "boundary"),
+                _tag("boundary", "administrative"),
+                _tag("admin_level", admin_level.c_str()));
+            ++counts.relations;
+            flush(writer, buffer);
+        }
+
+        flush(writer, buffer, true);
+        writer.close();
+
+        struct stat st;
+        if (::stat(filename.c_str(), &st) == 0) {
+            counts.bytes = static_cast<uint64_t>(st.st_size);
+        }
+        counts.seconds = seconds_since(start);
+        return counts;
+    }
+};
+
+/// A message in the verbose output that starts a pass.
+struct marker
+{
+    const char *text;
+    // Name of the pass, or nullptr if the message only ends the one before
+    const char *pass;
+    uint64_t objects;
+};
+
+struct pass_result
+{
+    std::string name;
+    double seconds;
+    uint64_t objects;
+};
+
+struct run_result
+{
+    std::string program;
+    std::vector<std::string> args;
+    int exit_code = -1;
+    double seconds = 0.0;
+    double cpu_seconds = 0.0;
+    long peak_rss_kb = 0;
+    std::vector<pass_result> passes;
+};
+
+double to_seconds(const struct timeval &tv)
+{
+    return static_cast<double>(tv.tv_sec) +
+           static_cast<double>(tv.tv_usec) / 1e6;
+}
+
+/**
+ * Run program with args, reading its stderr as it comes to time the passes
+ * started by markers. The program's stdout is discarded. With echo set its
+ * stderr is passed on.
+ */
+run_result run_program(const std::string &program,
+                       const std::vector<std::string> &args,
+                       const std::vector<marker> &markers, bool echo)
+{
+    run_result result;
+    result.program = program;
+    result.args = args;
+
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(program.c_str()));
+    for (const auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        std::perror("pipe");
+        return result;
+    }
+
+    const auto start = clock_type::now();
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        std::perror("fork");
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return result;
+    }
+    if (pid == 0) {
+        ::dup2(fds[1], 2);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        const int null = ::open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            ::dup2(null, 1);
+        }
+        ::execvp(argv[0], argv.data());
+        std::fprintf(stderr, "Can't run '%s': %s\n", argv[0],
+                     std::strerror(errno));
+        ::_exit(127);
+    }
+    ::close(fds[1]);
+
+    // The pass that is running and when it started
+    const marker *current = nullptr;
+    auto pass_start = start;
+    const auto end_pass = [&](clock_type::time_point now) {
+        if (current && current->pass) {
+            result.passes.push_back(pass_result{
+                current->pass, seconds_since(pass_start, now),
+                current->objects});
+        }
+    };
+
+    FILE *err = ::fdopen(fds[0], "r");
+    char line[4096];
+    while (err && std::fgets(line, sizeof(line), err)) {
+        const auto now = clock_type::now();
+        if (echo) {
+            std::cerr << line;
+        }
+        for (const auto &m : markers) {
+            if (std::strstr(line, m.text)) {
+                end_pass(now);
+                current = &m;
+                pass_start = now;
+                break;
+            }
+        }
+    }
+    if (err) {
+        std::fclose(err);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    std::memset(&usage, 0, sizeof(usage));
+    while (::wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+    }
+    const auto now = clock_type::now();
+    end_pass(now);
+
+    result.seconds = seconds_since(start, now);
+    result.cpu_seconds =
+        to_seconds(usage.ru_utime) + to_seconds(usage.ru_stime);
+    // Kilobytes on Linux
+    result.peak_rss_kb = usage.ru_maxrss;
+    if (WIFEXITED(status)) {
+        result.exit_code = WEXITSTATUS(status);
+    }
+    return result;
+}
+
+std::string json_string(const std::string &text)
+{
+    std::string out = "\"";
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + '"';
+}
+
+void write_json(std::ostream &out, const parameters &params,
+                unsigned int threads, const generated &input,
+                const std::vector<run_result> &runs)
+{
+    out << "{\n"
+        << "  \"version\": " << json_string(OSMBORDER_VERSION) << ",\n"
+        << "  \"parameters\": {\n"
+        << "    \"relations\": " << params.relations << ",\n"
+        << "    \"ways_per_relation\": " << params.ways_per_relation << ",\n"
+        << "    \"nodes_per_way\": " << params.nodes_per_way << ",\n"
+        << "    \"id_sparsity\": " << params.id_sparsity << ",\n"
+        << "    \"extra_ways_per_relation\": "
+        << params.extra_ways_per_relation << ",\n"
+        << "    \"threads\": " << threads << "\n"
+        << "  },\n"
+        << "  \"input\": {\n"
+        << "    \"bytes\": " << input.bytes << ",\n"
+        << "    \"nodes\": " << input.nodes << ",\n"
+        << "    \"ways\": " << input.ways << ",\n"
+        << "    \"relations\": " << input.relations << ",\n"
+        << "    \"generate_seconds\": " << input.seconds << "\n"
+        << "  },\n"
+        << "  \"runs\": [";
+    for (size_t i = 0; i < runs.size(); ++i) {
+        const run_result &run = runs[i];
+        out << (i ? "," : "") << "\n    {\n"
+            << "      \"program\": " << json_string(run.program) << ",\n"
+            << "      \"args\": [";
+        for (size_t a = 0; a < run.args.size(); ++a) {
+            out << (a ? ", " : "") << json_string(run.args[a]);
+        }
+        out << "],\n"
+            << "      \"exit_code\": " << run.exit_code << ",\n"
+            << "      \"seconds\": " << run.seconds << ",\n"
+            << "      \"cpu_seconds\": " << run.cpu_seconds << ",\n"
+            << "      \"peak_rss_kb\": " << run.peak_rss_kb << ",\n"
+            << "      \"passes\": [";
+        for (size_t p = 0; p < run.passes.size(); ++p) {
+            const pass_result &pass = run.passes[p];
+            const double rate =
+                pass.seconds > 0.0 ? pass.objects / pass.seconds : 0.0;
+            out << (p ? "," : "") << "\n        {\"name\": "
+                << json_string(pass.name) << ", \"seconds\": " << pass.seconds
+                << ", \"objects\": " << pass.objects
+                << ", \"objects_per_second\": " << rate << "}";
+        }
+        out << "\n      ]\n    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void print_help()
+{
+    std::cout
+        << "osmborder_bench [OPTIONS]\n"
+        << "\nOptions:\n"
+        << "  -h, --help             - This help message\n"
+        << "  -b, --bin-dir=DIR      - Where osmborder and osmborder_filter "
+           "are\n"
+        << "                           (default: next to this program)\n"
+        << "  -d, --work-dir=DIR     - Where to put the generated files "
+           "(default: .)\n"
+        << "  -e, --echo             - Show the output of the programs\n"
+        << "  -g, --generate-only    - Only write the synthetic input and "
+           "keep it\n"
+        << "  -j, --threads=NUM      - Threads for osmborder (default: its "
+           "default)\n"
+        << "  -k, --keep             - Keep the generated files\n"
+        << "  -n, --nodes=NUM        - Nodes per way (default: 50)\n"
+        << "  -o, --output=FILE      - Write the JSON results to FILE "
+           "(default: stdout)\n"
+        << "  -r, --relations=NUM    - Number of boundary relations "
+           "(default: 1000)\n"
+        << "  -s, --sparsity=NUM     - Step between consecutive IDs "
+           "(default: 1)\n"
+        << "  -w, --ways=NUM         - Ways per relation (default: 20)\n"
+        << "  -x, --extra-ways=NUM   - Non-border ways per relation "
+           "(default: 20)\n"
+        << "  -V, --version          - Show version and exit\n"
+        << "\n";
+}
+
+unsigned int parse_count(const char *text, const char *option,
+                         unsigned int min)
+{
+    char *end = nullptr;
+    const long value = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < long(min) ||
+        value > 100000000L) {
+        std::cerr << option << " needs a number of at least " << min
+                  << ".\n";
+        std::exit(return_code_cmdline);
+    }
+    return static_cast<unsigned int>(value);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    parameters params;
+    std::string bin_dir;
+    std::string work_dir = ".";
+    std::string output_filename;
+    unsigned int threads = 0;
+    bool echo = false;
+    bool generate_only = false;
+    bool keep = false;
+
+    // By default the programs are next to this one
+    const char *slash = std::strrchr(argv[0], '/');
+    if (slash) {
+        bin_dir.assign(argv[0], static_cast<size_t>(slash - argv[0]));
+    }
+
+    static struct option long_options[] = {
+        {"bin-dir", required_argument, 0, 'b'},
+        {"work-dir", required_argument, 0, 'd'},
+        {"echo", no_argument, 0, 'e'},
+        {"generate-only", no_argument, 0, 'g'},
+        {"help", no_argument, 0, 'h'},
+        {"threads", required_argument, 0, 'j'},
+        {"keep", no_argument, 0, 'k'},
+        {"nodes", required_argument, 0, 'n'},
+        {"output", required_argument, 0, 'o'},
+        {"relations", required_argument, 0, 'r'},
+        {"sparsity", required_argument, 0, 's'},
+        {"ways", required_argument, 0, 'w'},
+        {"extra-ways", required_argument, 0, 'x'},
+        {"version", no_argument, 0, 'V'},
+        {0, 0, 0, 0}};
+
+    while (1) {
+        int c = getopt_long(argc, argv, "b:d:eghj:kn:o:r:s:w:x:V",
+                            long_options, 0);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'b':
+            bin_dir = optarg;
+            break;
+        case 'd':
+            work_dir = optarg;
+            break;
+        case 'e':
+            echo = true;
+            break;
+        case 'g':
+            generate_only = true;
+            break;
+        case 'h':
+            print_help();
+            std::exit(return_code_ok);
+        case 'j':
+            threads = parse_count(optarg, "--threads/-j", 1);
+            break;
+        case 'k':
+            keep = true;
+            break;
+        case 'n':
+            params.nodes_per_way = parse_count(optarg, "--nodes/-n", 2);
+            break;
+        case 'o':
+            output_filename = optarg;
+            break;
+        case 'r':
+            params.relations = parse_count(optarg, "--relations/-r", 1);
+            break;
+        case 's':
+            params.id_sparsity = parse_count(optarg, "--sparsity/-s", 1);
+            break;
+        case 'w':
+            params.ways_per_relation = parse_count(optarg, "--ways/-w", 1);
+            break;
+        case 'x':
+            params.extra_ways_per_relation =
+                parse_count(optarg, "--extra-ways/-x", 0);
+            break;
+        case 'V':
+            std::cout
+                << "osmborder_bench version " OSMBORDER_VERSION "\n"
+                << "License: GNU GENERAL PUBLIC LICENSE Version 3 "
+                   "<http://gnu.org/licenses/gpl.html>.\n"
+                << "This is free software: you are free to change and "
+                   "redistribute it.\n"
+                << "There is NO WARRANTY, to the extent permitted by law.\n";
+            std::exit(return_code_ok);
+        default:
+            std::exit(return_code_cmdline);
+        }
+    }
+
+    if (optind != argc) {
+        std::cerr << "Usage: osmborder_bench [OPTIONS]\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (uint64_t(params.ways_per_relation) * (params.nodes_per_way - 1) < 3) {
+        std::cerr << "Each relation needs at least three nodes on its "
+                     "ring.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    const std::string input_file = work_dir + "/osmborder_bench.osm.pbf";
+    const std::string filtered_file =
+        work_dir + "/osmborder_bench_filtered.osm.pbf";
+    const std::string lines_file = work_dir + "/osmborder_bench_lines.csv";
+
+    std::cerr << "Generating '" << input_file << "'.\n";
+    generated input;
+    try {
+        input = Generator{params}.write(input_file);
+    } catch (const std::exception &e) {
+        std::cerr << "Error writing input: " << e.what() << "\n";
+        std::exit(return_code_fatal);
+    }
+    std::cerr << "Wrote " << input.nodes << " nodes, " << input.ways
+              << " ways and " << input.relations << " relations in "
+              << input.seconds << " seconds.\n";
+    if (generate_only) {
+        return return_code_ok;
+    }
+
+    const std::string prefix = bin_dir.empty() ? "" : bin_dir + "/";
+    std::vector<run_result> runs;
+
+    std::cerr << "Running osmborder_filter.\n";
+    runs.push_back(run_program(
+        prefix + "osmborder_filter", {"-v", "-o", filtered_file, input_file},
+        {{"Reading relations (1st pass", "relations", input.relations},
+         {"Reading ways (2nd pass", "ways", input.ways},
+         {"Reading nodes (3rd pass", "nodes", input.nodes},
+         {"All done.", nullptr, 0}},
+        echo));
+
+    std::cerr << "Running osmborder.\n";
+    std::vector<std::string> args{"-v", "-o", lines_file};
+    if (threads) {
+        args.push_back("-j");
+        args.push_back(std::to_string(threads));
+    }
+    args.push_back(input_file);
+    runs.push_back(run_program(
+        prefix + "osmborder", args,
+        {{"Reading relations in pass 1.", "relations", input.relations},
+         {"Reading ways pass 2.", "ways", input.ways},
+         {"Reading nodes pass 3", "nodes", input.nodes},
+         {"Building linestrings", "linestrings", input.border_ways}},
+        echo));
+
+    if (!keep) {
+        std::remove(input_file.c_str());
+        std::remove(filtered_file.c_str());
+        std::remove(lines_file.c_str());
+    }
+
+    if (output_filename.empty()) {
+        write_json(std::cout, params, threads, input, runs);
+    } else {
+        std::ofstream out(output_filename);
+        write_json(out, params, threads, input, runs);
+        out.close();
+        if (!out) {
+            std::cerr << "Error writing '" << output_filename << "'.\n";
+            return return_code_fatal;
+        }
+    }
+
+    for (const auto &run : runs) {
+        if (run.exit_code < 0 || run.exit_code > return_code_warning) {
+            std::cerr << run.program << " failed with exit code "
+                      << run.exit_code << ".\n";
+            return return_code_error;
+        }
+    }
+    return return_code_ok;
+}
@@ -23,16 +23,18 @@
 
 #include <cstdlib>
 #include <getopt.h>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <osmium/handler/node_locations_for_ways.hpp>
+#include <osmium/index/map/all.hpp>
 #include <osmium/io/any_compression.hpp>
 #include <osmium/io/any_input.hpp>
 #include <osmium/io/error.hpp>
 #include <osmium/io/file.hpp>
 #include <osmium/io/header.hpp>
-#include <osmium/io/input_iterator.hpp>
-#include <osmium/io/output_iterator.hpp>
+#include <osmium/memory/buffer.hpp>
 #include <osmium/io/pbf_output.hpp>
 #include <osmium/osm/box.hpp>
 #include <osmium/osm/entity_bits.hpp>
@@ -40,18 +42,100 @@
 #include <osmium/osm/types.hpp>
 #include <osmium/util/memory.hpp>
 #include <osmium/util/verbose_output.hpp>
+#include <osmium/visitor.hpp>
 
+#include "blobindex.hpp"
+#include "compactmap.hpp"
+#include "idset.hpp"
+#include "parallel.hpp"
 #include "return_codes.hpp"
+#include "tagrules.hpp"
+
+namespace {
+
+/// What filtering one input buffer gives
+struct filtered
+{
+    filtered()
+    : buffer(64 * 1024, osmium::memory::Buffer::auto_grow::yes), ids()
+    {
+    }
+
+    // The objects to keep
+    osmium::memory::Buffer buffer;
+    // IDs of the objects they need from the next pass
+    std::vector<osmium::object_id_type> ids;
+};
+
+/**
+ * Read all buffers from reader and filter them on num_threads threads.
+ * filter(in, out) is called on a worker thread for each buffer and must
+ * only read shared state. consume(out) gets the results on this thread in
+ * the order of the input, so the output stays sorted like the input.
+ *
+ * The buffers are read in batches of a few per thread. libosmium decodes
+ * the next ones in the background while a batch is filtered.
+ */
+template <typename TFilter, typename TConsume>
+void filter_buffers(osmium::io::Reader &reader, unsigned int num_threads,
+                    TFilter &&filter, TConsume &&consume)
+{
+    const size_t batch_size = 4 * static_cast<size_t>(num_threads);
+    std::vector<osmium::memory::Buffer> batch;
+    for (;;) {
+        batch.clear();
+        while (batch.size() < batch_size) {
+            osmium::memory::Buffer buffer = reader.read();
+            if (!buffer) {
+                break;
+            }
+            batch.push_back(std::move(buffer));
+        }
+        if (batch.empty()) {
+            return;
+        }
+
+        std::vector<filtered> out(batch.size());
+        run_ordered(batch.size(), num_threads,
+                    [&](size_t i, unsigned int) {
+                        filter(batch[i], out[i]);
+                        out[i].buffer.commit();
+                        batch[i] = osmium::memory::Buffer();
+                    },
+                    [&](size_t i) {
+                        consume(out[i]);
+                        out[i] = filtered();
+                    });
+    }
+}
+
+} // anonymous namespace
 
 void print_help()
 {
     std::cout
         << "osmborder_filter [OPTIONS] OSMFILE\n"
         << "\nOptions:\n"
-        << "  -h, --help           - This help message\n"
-        << "  -o, --output=OSMFILE - Where to write output (default: none)\n"
-        << "  -v, --verbose        - Verbose output\n"
-        << "  -V, --version        - Show version and exit\n"
+        << "  -h, --help            - This help message\n"
+        << "  -I, --blob-index      - Index the blobs of PBF input and only "
+           "read the\n"
+        << "                          ones each pass needs\n"
+        << "  -i, --index-type=TYPE - Node location index for "
+           "--add-locations\n"
+        << "                          (default: sparse_mem_array)\n"
+        << "  -l, --add-locations   - Add node locations to ways instead of "
+           "writing nodes\n"
+        << "                          (needs PBF output, keeps the border "
+           "ways in memory\n"
+        << "                          until the nodes are read)\n"
+        << "  -j, --threads=NUM     - Number of threads for filtering "
+           "(default: number\n"
+        << "                          of CPUs)\n"
+        << "  -o, --output=OSMFILE  - Where to write output (default: none)\n"
+        << "  -R, --rules=FILE      - Read the tag classification rules from "
+           "FILE\n"
+        << "  -v, --verbose         - Verbose output\n"
+        << "  -V, --version         - Show version and exit\n"
         << "\n";
 }
 
@@ -59,16 +143,26 @@ int main(int argc, char *argv[])
 {
     std::string output_filename;
     bool verbose = false;
+    bool add_locations = false;
+    bool use_blob_index = false;
+    std::string index_type{"sparse_mem_array"};
+    std::string rules_file;
+    unsigned int num_threads = default_num_threads();
 
     static struct option long_options[] = {
         {"help", no_argument, 0, 'h'},
+        {"blob-index", no_argument, 0, 'I'},
+        {"index-type", required_argument, 0, 'i'},
+        {"threads", required_argument, 0, 'j'},
+        {"add-locations", no_argument, 0, 'l'},
         {"output", required_argument, 0, 'o'},
+        {"rules", required_argument, 0, 'R'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
         {0, 0, 0, 0}};
 
     while (1) {
-        int c = getopt_long(argc, argv, "ho:vV", long_options, 0);
+        int c = getopt_long(argc, argv, "hIi:j:lo:R:vV", long_options, 0);
         if (c == -1)
             break;
 
@@ -76,9 +170,30 @@ int main(int argc, char *argv[])
         case 'h':
             print_help();
             std::exit(return_code_ok);
+        case 'I':
+            use_blob_index = true;
+            break;
+        case 'i':
+            index_type = optarg;
+            break;
+        case 'j': {
+            const int n = std::atoi(optarg);
+            if (n < 1) {
+                std::cerr << "Number of threads must be at least 1.\n";
+                std::exit(return_code_cmdline);
+            }
+            num_threads = static_cast<unsigned int>(n);
+            break;
+        }
+        case 'l':
+            add_locations = true;
+            break;
         case 'o':
             output_filename = optarg;
             break;
+        case 'R':
+            rules_file = optarg;
+            break;
         case 'v':
             verbose = true;
             break;
@@ -112,99 +227,189 @@ int main(int argc, char *argv[])
         std::exit(return_code_cmdline);
     }
 
+    TagRules rules;
+    if (!rules_file.empty()) {
+        try {
+            rules.load(rules_file);
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            std::exit(return_code_fatal);
+        }
+    }
+
     osmium::io::Header header;
     header.set("generator", "osmborder_filter");
     header.add_box(osmium::Box{-180.0, -90.0, 180.0, 90.0});
 
     osmium::io::File infile{argv[optind]};
 
+    // With locations on ways, osmborder can build the linestrings without
+    // reading any nodes, so they aren't written at all.
+    osmium::io::File outfile{output_filename};
+    if (add_locations) {
+        outfile.set("locations_on_ways");
+    }
+
+    typedef osmium::index::map::Map<osmium::unsigned_object_id_type,
+                                    osmium::Location>
+        location_index_type;
+    typedef osmium::handler::NodeLocationsForWays<location_index_type,
+                                                  location_index_type>
+        location_handler_type;
+
+    // The node location index is made up front, so a wrong type is
+    // reported before the long passes. The types are the ones osmborder
+    // has for --index-type.
+    std::unique_ptr<location_index_type> index_pos;
+    std::unique_ptr<location_index_type> index_neg;
+    if (add_locations) {
+        CompactLocationMap::register_type();
+        const auto &map_factory = osmium::index::MapFactory<
+            osmium::unsigned_object_id_type, osmium::Location>::instance();
+        try {
+            index_pos = map_factory.create_map(index_type);
+            // Negative IDs don't occur in OSM data, so a small sparse index
+            // is enough for them whatever the type for the others
+            index_neg = map_factory.create_map("sparse_mem_array");
+        } catch (const std::runtime_error &e) {
+            // Includes osmium::map_factory_error for unknown types
+            std::cerr << e.what() << "\nAvailable index types:";
+            for (const auto &type : map_factory.map_types()) {
+                std::cerr << ' ' << type;
+            }
+            std::cerr << "\n";
+            std::exit(return_code_fatal);
+        }
+    }
+
+    BlobIndex blob_index;
+    if (use_blob_index) {
+        vout << "Opening blob index...\n";
+        try {
+            if (!blob_index.open(argv[optind], num_threads)) {
+                std::cerr << "Warning: --blob-index only works for PBF "
+                             "files, and not on Windows.\n";
+            }
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            std::exit(return_code_fatal);
+        }
+    }
+
     try {
-        osmium::io::Writer writer{output_filename, header};
-        auto output_it = osmium::io::make_output_iterator(writer);
+        osmium::io::Writer writer{outfile, header};
 
-        std::vector<osmium::object_id_type> way_ids;
-        std::vector<osmium::object_id_type> node_ids;
+        IdSet way_ids;
+        IdSet node_ids;
+        osmium::memory::Buffer ways_buffer{
+            1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
 
         vout << "Reading relations (1st pass through input file)...\n";
         {
-            osmium::io::Reader reader{infile,
+            const auto blobs =
+                blob_index.select(osmium::osm_entity_bits::relation);
+            osmium::io::Reader reader{blobs ? blobs->file() : infile,
                                       osmium::osm_entity_bits::relation};
-            auto relations =
-                osmium::io::make_input_iterator_range<const osmium::Relation>(
-                    reader);
-            for (const osmium::Relation &relation : relations) {
-                if (relation.tags().has_tag("boundary", "administrative")) {
-                    *output_it++ = relation;
-                    for (const auto &rm : relation.members()) {
-                        if (rm.type() == osmium::item_type::way) {
-                            way_ids.push_back(rm.ref());
+            filter_buffers(
+                reader, num_threads,
+                [&rules](const osmium::memory::Buffer &in, filtered &out) {
+                    for (auto it = in.cbegin<osmium::Relation>();
+                         it != in.cend<osmium::Relation>(); ++it) {
+                        const TagRules::relation_class rc =
+                            rules.classify_relation(it->tags());
+                        if (rc.border || rc.flags) {
+                            out.buffer.add_item(*it);
+                        }
+                        // Relations that only have flags don't make their
+                        // ways border ways
+                        if (rc.border) {
+                            for (const auto &rm : it->members()) {
+                                if (rm.type() == osmium::item_type::way) {
+                                    out.ids.push_back(rm.ref());
+                                }
+                            }
                         }
                     }
-                }
-            }
+                },
+                [&](filtered &out) {
+                    for (const auto id : out.ids) {
+                        way_ids.set(id);
+                    }
+                    writer(std::move(out.buffer));
+                });
             reader.close();
         }
 
-        vout << "Preparing way ID list...\n";
-        std::sort(way_ids.begin(), way_ids.end());
-
         vout << "Reading ways (2nd pass through input file)...\n";
-
         {
-            osmium::io::Reader reader{infile, osmium::osm_entity_bits::way};
-            auto ways =
-                osmium::io::make_input_iterator_range<const osmium::Way>(
-                    reader);
-
-            auto first = way_ids.begin();
-            auto last = std::unique(way_ids.begin(), way_ids.end());
-
-            for (const osmium::Way &way : ways) {
-                // Advance the target list to the first possible way
-                while (*first < way.id() && first != last) {
-                    ++first;
-                }
-
-                if (way.id() == *first) {
-                    *output_it++ = way;
-                    for (const auto &nr : way.nodes()) {
-                        node_ids.push_back(nr.ref());
+            const auto blobs =
+                blob_index.select(osmium::osm_entity_bits::way, &way_ids);
+            osmium::io::Reader reader{blobs ? blobs->file() : infile,
+                                      osmium::osm_entity_bits::way};
+            filter_buffers(
+                reader, num_threads,
+                [&way_ids](const osmium::memory::Buffer &in, filtered &out) {
+                    for (auto it = in.cbegin<osmium::Way>();
+                         it != in.cend<osmium::Way>(); ++it) {
+                        if (way_ids.get(it->id())) {
+                            out.buffer.add_item(*it);
+                            for (const auto &nr : it->nodes()) {
+                                out.ids.push_back(nr.ref());
+                            }
+                        }
                     }
-                    if (first != last) {
-                        ++first;
+                },
+                [&](filtered &out) {
+                    for (const auto id : out.ids) {
+                        node_ids.set(id);
                     }
-                }
-            }
+                    if (add_locations) {
+                        // Written once the node locations are known
+                        ways_buffer.add_buffer(out.buffer);
+                        ways_buffer.commit();
+                    } else {
+                        writer(std::move(out.buffer));
+                    }
+                });
+            reader.close();
         }
 
-        vout << "Preparing node ID list...\n";
-        std::sort(node_ids.begin(), node_ids.end());
-        auto last = std::unique(node_ids.begin(), node_ids.end());
-
         vout << "Reading nodes (3rd pass through input file)...\n";
         {
-            osmium::io::Reader reader{infile, osmium::osm_entity_bits::node};
-            auto nodes =
-                osmium::io::make_input_iterator_range<const osmium::Node>(
-                    reader);
-
-            auto first = node_ids.begin();
-            std::copy_if(nodes.cbegin(), nodes.cend(), output_it,
-                         [&first, &last](const osmium::Node &node) {
-                             while (*first < node.id() && first != last) {
-                                 ++first;
-                             }
-
-                             if (node.id() == *first) {
-                                 if (first != last) {
-                                     ++first;
-                                 }
-                                 return true;
-                             }
-                             return false;
-                         });
-
-            reader.close();
+            const auto blobs =
+                blob_index.select(osmium::osm_entity_bits::node, &node_ids);
+            osmium::io::Reader reader{blobs ? blobs->file() : infile,
+                                      osmium::osm_entity_bits::node};
+            const auto filter_nodes = [&node_ids](
+                const osmium::memory::Buffer &in, filtered &out) {
+                for (auto it = in.cbegin<osmium::Node>();
+                     it != in.cend<osmium::Node>(); ++it) {
+                    if (node_ids.get(it->id())) {
+                        out.buffer.add_item(*it);
+                    }
+                }
+            };
+
+            if (add_locations) {
+                location_handler_type location_handler{*index_pos,
+                                                       *index_neg};
+                location_handler.ignore_errors();
+                filter_buffers(reader, num_threads, filter_nodes,
+                               [&](filtered &out) {
+                                   osmium::apply(out.buffer, location_handler);
+                               });
+                reader.close();
+
+                vout << "Writing ways with locations...\n";
+                osmium::apply(ways_buffer, location_handler);
+                writer(std::move(ways_buffer));
+            } else {
+                filter_buffers(reader, num_threads, filter_nodes,
+                               [&](filtered &out) {
+                                   writer(std::move(out.buffer));
+                               });
+                reader.close();
+            }
         }
 
         writer.close();
@@ -0,0 +1,325 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "compress.hpp"
+#include "output.hpp"
+#include "pgcopy.hpp"
+#include "return_codes.hpp"
+
+namespace {
+
+// Signature at the start of PostgreSQL binary COPY files
+const char pgcopy_signature[11] = {'P',  'G',    'C',  'O',  'P', 'Y',
+                                   '\n', '\377', '\r', '\n', '\0'};
+// Signature, flags and header extension length
+const size_t pgcopy_header_size = 19;
+
+/**
+ * Reads the rows of one output file of osmborder, in csv or pgcopy-binary
+ * format, and the way ID at the start of each.
+ */
+class RowReader
+{
+public:
+    explicit RowReader(const std::string &filename)
+    : m_filename(filename), m_in(filename, std::ios::binary)
+    {
+        if (!m_in) {
+            throw std::runtime_error{"Can't open '" + filename +
+                                     "': " + std::strerror(errno)};
+        }
+        if (compression_for(filename) != compression::none) {
+            throw std::runtime_error{"Can't read compressed input '" +
+                                     filename + "', decompress it first"};
+        }
+        char signature[sizeof(pgcopy_signature)];
+        m_in.read(signature, sizeof(signature));
+        m_binary = m_in.gcount() == sizeof(signature) &&
+                   std::memcmp(signature, pgcopy_signature,
+                               sizeof(signature)) == 0;
+        m_in.clear();
+        m_in.seekg(0);
+        if (m_binary) {
+            read(m_header, pgcopy_header_size);
+            if (int32_at(m_header, pgcopy_header_size - 4) != 0) {
+                throw error("has a header extension");
+            }
+        }
+    }
+
+    /// Is this pgcopy-binary output?
+    bool binary() const { return m_binary; }
+
+    /// The pgcopy-binary header, empty for csv
+    const std::string &header() const { return m_header; }
+
+    /**
+     * Read the next row. Returns false at the end of the file. Throws
+     * std::runtime_error if the file is broken or the rows aren't sorted
+     * by way ID.
+     */
+    bool next()
+    {
+        const bool have_row = m_binary ? next_tuple() : next_line();
+        if (!have_row) {
+            return false;
+        }
+        if (m_rows > 0 && m_id < m_last_id) {
+            throw error("is not sorted by way ID");
+        }
+        m_last_id = m_id;
+        ++m_rows;
+        return true;
+    }
+
+    const std::string &row() const { return m_row; }
+
+    int64_t id() const { return m_id; }
+
+private:
+    std::runtime_error error(const std::string &message) const
+    {
+        return std::runtime_error{"'" + m_filename + "' " + message};
+    }
+
+    void read(std::string &out, size_t size)
+    {
+        const size_t start = out.size();
+        out.resize(start + size);
+        m_in.read(&out[start], static_cast<std::streamsize>(size));
+        if (static_cast<size_t>(m_in.gcount()) != size) {
+            throw error("ends in the middle of a row");
+        }
+    }
+
+    static uint32_t int32_at(const std::string &data, size_t offset)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            value = (value << 8) | static_cast<unsigned char>(data[offset + i]);
+        }
+        return value;
+    }
+
+    bool next_tuple()
+    {
+        m_row.clear();
+        read(m_row, 2);
+        const int16_t fields = static_cast<int16_t>(
+            (static_cast<unsigned char>(m_row[0]) << 8) |
+            static_cast<unsigned char>(m_row[1]));
+        if (fields == -1) {
+            return false;
+        }
+        for (int16_t i = 0; i < fields; ++i) {
+            const size_t offset = m_row.size();
+            read(m_row, 4);
+            const int32_t length = static_cast<int32_t>(int32_at(m_row, offset));
+            if (i == 0 && length != 8) {
+                throw error("doesn't start rows with a way ID");
+            }
+            if (length > 0) {
+                read(m_row, static_cast<size_t>(length));
+            }
+        }
+        if (fields < 1) {
+            throw error("has an empty row");
+        }
+        uint64_t id = 0;
+        for (size_t i = 6; i < 14; ++i) {
+            id = (id << 8) | static_cast<unsigned char>(m_row[i]);
+        }
+        m_id = static_cast<int64_t>(id);
+        return true;
+    }
+
+    bool next_line()
+    {
+        if (!std::getline(m_in, m_row)) {
+            if (m_in.bad()) {
+                throw error("can't be read");
+            }
+            return false;
+        }
+        m_row += '\n';
+        char *end = nullptr;
+        errno = 0;
+        m_id = std::strtoll(m_row.c_str(), &end, 10);
+        if (end == m_row.c_str() || *end != '\t' || errno == ERANGE) {
+            throw error("is not osmborder csv output");
+        }
+        return true;
+    }
+
+    std::string m_filename;
+    std::ifstream m_in;
+    bool m_binary = false;
+    std::string m_header;
+    std::string m_row;
+    int64_t m_id = 0;
+    int64_t m_last_id = 0;
+    uint64_t m_rows = 0;
+};
+
+void print_help()
+{
+    std::cout << "osmborder_merge [OPTIONS] FILE...\n"
+              << "\nMerge the outputs of osmborder --shard into one, sorted "
+                 "by way ID.\n"
+              << "\nOptions:\n"
+              << "  -h, --help             - This help message\n"
+              << "  -o, --output-file=FILE - Where to write the merged "
+                 "output\n"
+              << "  -v, --verbose          - Verbose output\n"
+              << "  -V, --version          - Show version and exit\n"
+              << "\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+    std::string output_file;
+    bool verbose = false;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"output-file", required_argument, 0, 'o'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {0, 0, 0, 0}};
+
+    while (1) {
+        int c = getopt_long(argc, argv, "ho:vV", long_options, 0);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'h':
+            print_help();
+            std::exit(return_code_ok);
+        case 'o':
+            output_file = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'V':
+            std::cout
+                << "osmborder_merge version " OSMBORDER_VERSION "\n"
+                << "Copyright (C) 2016  Paul Norman <penorman@mac.com>\n"
+                << "License: GNU GENERAL PUBLIC LICENSE Version 3 "
+                   "<http://gnu.org/licenses/gpl.html>.\n"
+                << "This is free software: you are free to change and "
+                   "redistribute it.\n"
+                << "There is NO WARRANTY, to the extent permitted by law.\n";
+            std::exit(return_code_ok);
+        default:
+            std::exit(return_code_cmdline);
+        }
+    }
+
+    if (output_file.empty()) {
+        std::cerr << "Missing --output-file/-o option.\n";
+        std::exit(return_code_cmdline);
+    }
+
+    if (optind >= argc) {
+        std::cerr << "Usage: osmborder_merge [OPTIONS] FILE...\n";
+        std::exit(return_code_cmdline);
+    }
+
+    try {
+        std::vector<std::unique_ptr<RowReader>> inputs;
+        for (int i = optind; i < argc; ++i) {
+            inputs.emplace_back(new RowReader{argv[i]});
+            if (inputs.back()->binary() != inputs.front()->binary() ||
+                inputs.back()->header() != inputs.front()->header()) {
+                std::cerr << "'" << argv[i] << "' has a different format "
+                          << "than '" << argv[optind] << "'.\n";
+                return return_code_fatal;
+            }
+        }
+        const bool binary = inputs.front()->binary();
+
+        OutputWriter out(output_file);
+        if (binary) {
+            out.write(inputs.front()->header());
+        }
+
+        // Inputs with rows left, by the ID of their current row. Ties go to
+        // the input given first, so the result doesn't depend on timing.
+        typedef std::pair<int64_t, size_t> entry;
+        std::priority_queue<entry, std::vector<entry>, std::greater<entry>>
+            queue;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (inputs[i]->next()) {
+                queue.emplace(inputs[i]->id(), i);
+            }
+        }
+
+        uint64_t rows = 0;
+        while (!queue.empty()) {
+            const size_t i = queue.top().second;
+            queue.pop();
+            out.write(inputs[i]->row());
+            ++rows;
+            if (inputs[i]->next()) {
+                queue.emplace(inputs[i]->id(), i);
+            }
+        }
+
+        if (binary) {
+            std::string trailer;
+            pgcopy::append_trailer(trailer);
+            out.write(std::move(trailer));
+        }
+        out.close();
+
+        if (verbose) {
+            std::cerr << "Merged " << rows << " rows from " << inputs.size()
+                      << " files.\n";
+        }
+    } catch (const std::runtime_error &e) {
+        // Includes std::system_error from writing the output
+        std::cerr << e.what() << "\n";
+        return return_code_fatal;
+    }
+
+    return return_code_ok;
+}
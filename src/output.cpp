@@ -0,0 +1,282 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#include "output.hpp"
+#include "parallel.hpp"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+namespace {
+
+void write_all(int fd, const char *data, size_t size)
+{
+    // Some systems have trouble with very large writes
+    static constexpr size_t max_write = 100 * 1024 * 1024;
+    size_t offset = 0;
+    while (offset < size) {
+        size_t count = size - offset;
+        if (count > max_write) {
+            count = max_write;
+        }
+        long length;
+        do {
+            length = ::write(fd, data + offset,
+                             static_cast<unsigned int>(count));
+        } while (length < 0 && errno == EINTR);
+        if (length < 0) {
+            throw std::system_error{errno, std::system_category(),
+                                    "Write failed"};
+        }
+        offset += static_cast<size_t>(length);
+    }
+}
+
+int open_output(const std::string &filename)
+{
+    // Check this before the file is created
+    if (!compression_available(compression_for(filename))) {
+        throw std::runtime_error{"Can't write '" + filename +
+                                 "', osmborder was built without zstd"};
+    }
+    const int fd = ::open(filename.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(),
+                                "Open failed for '" + filename + "'"};
+    }
+    return fd;
+}
+
+} // anonymous namespace
+
+OutputWriter::OutputWriter(const std::string &filename,
+                           unsigned int compress_threads)
+: m_fd(open_output(filename)), m_compression(compression_for(filename))
+{
+    m_thread = std::thread(&OutputWriter::run, this);
+    if (m_compression != compression::none) {
+        if (compress_threads == 0) {
+            compress_threads = default_num_threads();
+        }
+        for (unsigned int i = 0; i < compress_threads; ++i) {
+            m_compressors.emplace_back(&OutputWriter::run_compressor, this);
+        }
+    }
+}
+
+OutputWriter::~OutputWriter()
+{
+    try {
+        close();
+    } catch (...) {
+        // Ignore errors in the destructor
+    }
+}
+
+void OutputWriter::write(std::string &&data)
+{
+    if (m_compression != compression::none) {
+        // Keep the blocks the same size so the compressors share the work
+        m_pending += data;
+        size_t offset = 0;
+        while (m_pending.size() - offset >= chunk_size) {
+            enqueue(m_pending.substr(offset, chunk_size));
+            offset += chunk_size;
+        }
+        m_pending.erase(0, offset);
+        return;
+    }
+    if (m_pending.empty() && data.size() >= chunk_size) {
+        enqueue(std::move(data));
+        return;
+    }
+    m_pending += data;
+    if (m_pending.size() >= chunk_size) {
+        enqueue(std::move(m_pending));
+        m_pending = std::string();
+    }
+}
+
+void OutputWriter::enqueue(std::string &&data)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space_cv.wait(lock,
+                    [this] { return m_queued < max_queued || m_error; });
+    if (m_error) {
+        lock.unlock();
+        rethrow_error();
+    }
+    m_queued += data.size();
+    m_enqueued = true;
+    const bool compress = m_compression != compression::none;
+    std::shared_ptr<block> b{new block{std::move(data), !compress}};
+    m_queue.push_back(b);
+    if (compress) {
+        m_to_compress.push_back(std::move(b));
+        m_compress_cv.notify_one();
+    } else {
+        m_queue_cv.notify_one();
+    }
+}
+
+void OutputWriter::set_error(std::exception_ptr error)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_error) {
+        m_error = error;
+    }
+    m_queue.clear();
+    m_to_compress.clear();
+    m_queue_cv.notify_all();
+    m_space_cv.notify_all();
+    m_compress_cv.notify_all();
+}
+
+void OutputWriter::rethrow_error()
+{
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        error = m_error;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void OutputWriter::close()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+    // Even an empty compressed file needs a gzip member or zstd frame, or
+    // tools like zcat reject it
+    if (!m_pending.empty() ||
+        (m_compression != compression::none && !m_enqueued)) {
+        try {
+            enqueue(std::move(m_pending));
+        } catch (...) {
+            // Reported below once the thread is gone
+        }
+        m_pending = std::string();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_queue_cv.notify_one();
+    m_compress_cv.notify_all();
+    m_thread.join();
+    for (auto &compressor : m_compressors) {
+        compressor.join();
+    }
+    m_compressors.clear();
+
+    if (::close(m_fd) != 0 && !m_error) {
+        m_error = std::make_exception_ptr(std::system_error{
+            errno, std::system_category(), "Close failed"});
+    }
+    m_fd = -1;
+    rethrow_error();
+}
+
+void OutputWriter::run()
+{
+    for (;;) {
+        std::shared_ptr<block> b;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_queue_cv.wait(lock, [this] {
+                if (m_error) {
+                    return true;
+                }
+                return m_queue.empty() ? m_done : m_queue.front()->ready;
+            });
+            if (m_error || m_queue.empty()) {
+                return;
+            }
+            b = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        try {
+            write_all(m_fd, b->data.data(), b->data.size());
+        } catch (...) {
+            set_error(std::current_exception());
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queued -= b->data.size();
+        }
+        m_space_cv.notify_one();
+    }
+}
+
+void OutputWriter::run_compressor()
+{
+    for (;;) {
+        std::shared_ptr<block> b;
+        std::string data;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_compress_cv.wait(lock, [this] {
+                return m_done || m_error || !m_to_compress.empty();
+            });
+            if (m_error || m_to_compress.empty()) {
+                return;
+            }
+            b = std::move(m_to_compress.front());
+            m_to_compress.pop_front();
+            data = std::move(b->data);
+        }
+        std::string compressed;
+        try {
+            compressed = compress(data, m_compression);
+        } catch (...) {
+            set_error(std::current_exception());
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // The queue only holds back writers by what ends up on disk
+            m_queued -= data.size();
+            m_queued += compressed.size();
+            b->data = std::move(compressed);
+            b->ready = true;
+        }
+        m_queue_cv.notify_one();
+        m_space_cv.notify_one();
+    }
+}
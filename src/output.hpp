@@ -0,0 +1,157 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "compress.hpp"
+
+/**
+ * Append the decimal representation of value. Unlike std::ostream this
+ * doesn't look at the locale, and unlike std::to_string it doesn't need a
+ * temporary string.
+ */
+inline void append_int(std::string &out, int64_t value)
+{
+    char buffer[24];
+    char *end = buffer + sizeof(buffer);
+    char *p = end;
+    uint64_t v = value < 0 ? 0 - static_cast<uint64_t>(value)
+                           : static_cast<uint64_t>(value);
+    do {
+        *--p = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) {
+        *--p = '-';
+    }
+    out.append(p, static_cast<size_t>(end - p));
+}
+
+/**
+ * Append data as upper case hex, the same encoding libosmium uses for hex
+ * WKB.
+ */
+inline void append_hex(std::string &out, const std::string &data)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    const size_t start = out.size();
+    out.resize(start + 2 * data.size());
+    char *p = &out[start];
+    for (const char c : data) {
+        const unsigned char byte = static_cast<unsigned char>(c);
+        *p++ = digits[byte >> 4];
+        *p++ = digits[byte & 0xf];
+    }
+}
+
+/**
+ * Writes an output file from a background thread.
+ *
+ * Data handed to write() is collected until there is a large chunk of it,
+ * which is then queued for the writer thread and written with write(2).
+ * The caller only blocks if the writer thread falls far enough behind.
+ *
+ * If the file name ends in ".gz" or ".zst", each chunk is compressed into
+ * a separate gzip member or zstd frame on a pool of compressor threads.
+ * The writer still writes the chunks in order, and the concatenated
+ * members form a normal compressed file.
+ */
+class OutputWriter
+{
+public:
+    /**
+     * Open filename for writing. compress_threads is the number of
+     * compressor threads for compressed files, 0 for one per core.
+     */
+    explicit OutputWriter(const std::string &filename,
+                          unsigned int compress_threads = 0);
+
+    /// Closes the file if close() wasn't called, ignoring any errors.
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    /**
+     * Add data to the output. Throws std::system_error if an earlier write
+     * failed.
+     */
+    void write(std::string &&data);
+
+    void write(const std::string &data) { write(std::string(data)); }
+
+    /**
+     * Write out everything still pending and close the file. Throws
+     * std::system_error if any write failed.
+     */
+    void close();
+
+private:
+    // Chunks are handed to the writer thread once they are this big
+    static constexpr size_t chunk_size = 4 * 1024 * 1024;
+    // Writers block while this much is queued
+    static constexpr size_t max_queued = 64 * 1024 * 1024;
+
+    // A queued chunk, ready once it is compressed
+    struct block
+    {
+        std::string data;
+        bool ready;
+    };
+
+    int m_fd;
+    const compression m_compression;
+    std::string m_pending;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queue_cv;
+    std::condition_variable m_space_cv;
+    std::condition_variable m_compress_cv;
+    // Blocks in file order, for the writer thread
+    std::deque<std::shared_ptr<block>> m_queue;
+    // Blocks still waiting for a compressor thread
+    std::deque<std::shared_ptr<block>> m_to_compress;
+    size_t m_queued = 0;
+    // Was anything handed to the queue yet?
+    bool m_enqueued = false;
+    bool m_done = false;
+    std::exception_ptr m_error;
+    std::thread m_thread;
+    std::vector<std::thread> m_compressors;
+
+    void enqueue(std::string &&data);
+    void set_error(std::exception_ptr error);
+    void rethrow_error();
+    void run();
+    void run_compressor();
+};
+
+#endif // OUTPUT_HPP
@@ -0,0 +1,154 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Number of worker threads to use if none was given on the command line.
+ */
+inline unsigned int default_num_threads()
+{
+    const unsigned int n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+/**
+ * Process count chunks of work on num_threads worker threads, handing the
+ * results back in chunk order.
+ *
+ * work(chunk, thread) is called on a worker thread, where thread is the
+ * index of that worker in [0, num_threads). It can be used to give each
+ * thread its own state. consume(chunk) is called on the calling thread in
+ * order 0, 1, 2, ... once that chunk's work is done. Workers never get more
+ * than a few chunks per thread ahead of consume(), which bounds the memory
+ * held by finished but unconsumed chunks.
+ *
+ * The first exception thrown by work() or consume() stops all threads and
+ * is rethrown to the caller.
+ */
+template <typename TWork, typename TConsume>
+void run_ordered(size_t count, unsigned int num_threads, TWork &&work,
+                 TConsume &&consume)
+{
+    if (num_threads <= 1) {
+        for (size_t chunk = 0; chunk < count; ++chunk) {
+            work(chunk, 0u);
+            consume(chunk);
+        }
+        return;
+    }
+
+    const size_t window = 4 * static_cast<size_t>(num_threads);
+
+    std::mutex mutex;
+    // Workers wait on this for room in the window
+    std::condition_variable work_cv;
+    // The consumer waits on this for the next chunk to finish
+    std::condition_variable done_cv;
+
+    // All guarded by mutex
+    std::vector<char> done(count, 0);
+    size_t next = 0;
+    size_t consumed = 0;
+    bool abort = false;
+    std::exception_ptr error;
+
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = e;
+        }
+        abort = true;
+        work_cv.notify_all();
+        done_cv.notify_all();
+    };
+
+    auto worker = [&](unsigned int thread) {
+        for (;;) {
+            size_t chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_cv.wait(lock, [&] {
+                    return abort || next >= count || next < consumed + window;
+                });
+                if (abort || next >= count) {
+                    return;
+                }
+                chunk = next++;
+            }
+            try {
+                work(chunk, thread);
+            } catch (...) {
+                fail(std::current_exception());
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done[chunk] = 1;
+            }
+            done_cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(worker, i);
+    }
+
+    for (size_t chunk = 0; chunk < count; ++chunk) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done_cv.wait(lock, [&] { return abort || done[chunk]; });
+            if (abort) {
+                break;
+            }
+        }
+        try {
+            consume(chunk);
+        } catch (...) {
+            fail(std::current_exception());
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++consumed;
+        }
+        work_cv.notify_all();
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,119 @@
+#ifndef PGCOPY_HPP
+#define PGCOPY_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Helpers for writing the PostgreSQL binary COPY format. See
+ * https://www.postgresql.org/docs/current/static/sql-copy.html
+ *
+ * All integers are in network byte order.
+ */
+namespace pgcopy {
+
+inline void append_int16(std::string &out, int16_t value)
+{
+    const uint16_t v = static_cast<uint16_t>(value);
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v);
+}
+
+inline void append_int32(std::string &out, int32_t value)
+{
+    const uint32_t v = static_cast<uint32_t>(value);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out += static_cast<char>(v >> shift);
+    }
+}
+
+inline void append_int64(std::string &out, int64_t value)
+{
+    const uint64_t v = static_cast<uint64_t>(value);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out += static_cast<char>(v >> shift);
+    }
+}
+
+/// File signature, flags field and empty header extension
+inline void append_header(std::string &out)
+{
+    out.append("PGCOPY\n\377\r\n\0", 11);
+    append_int32(out, 0);
+    append_int32(out, 0);
+}
+
+inline void append_trailer(std::string &out) { append_int16(out, -1); }
+
+/// Start of a tuple with the given number of fields
+inline void append_tuple(std::string &out, int16_t fields)
+{
+    append_int16(out, fields);
+}
+
+inline void append_bigint_field(std::string &out, int64_t value)
+{
+    append_int32(out, 8);
+    append_int64(out, value);
+}
+
+inline void append_int_field(std::string &out, int32_t value)
+{
+    append_int32(out, 4);
+    append_int32(out, value);
+}
+
+inline void append_bool_field(std::string &out, bool value)
+{
+    append_int32(out, 1);
+    out += value ? '\1' : '\0';
+}
+
+/// A one-dimensional bigint[] array without NULLs
+inline void append_bigint_array_field(std::string &out,
+                                      const std::vector<int64_t> &values)
+{
+    // Type OID of the bigint elements
+    static const int32_t int8_oid = 20;
+    append_int32(out, static_cast<int32_t>(20 + 12 * values.size()));
+    append_int32(out, 1); // dimensions
+    append_int32(out, 0); // no NULLs
+    append_int32(out, int8_oid);
+    append_int32(out, static_cast<int32_t>(values.size()));
+    append_int32(out, 1); // lower bound
+    for (const auto value : values) {
+        append_bigint_field(out, value);
+    }
+}
+
+/// A field sent as-is, such as the (E)WKB of a PostGIS geometry
+inline void append_bytes_field(std::string &out, const std::string &data)
+{
+    append_int32(out, static_cast<int32_t>(data.size()));
+    out += data;
+}
+
+} // namespace pgcopy
+
+#endif // PGCOPY_HPP
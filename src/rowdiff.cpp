@@ -0,0 +1,159 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "rowdiff.hpp"
+
+namespace {
+
+// Number of IDs in each DELETE statement
+const size_t ids_per_delete = 10000;
+
+} // anonymous namespace
+
+RowDiff::RowDiff(const std::string &old_file)
+{
+    std::ifstream in(old_file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error{"Can't open '" + old_file +
+                                 "': " + std::strerror(errno)};
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        old_row row;
+        const char *begin = line.data();
+        const char *end = begin + line.size();
+        if (!parse_id(begin, end, row.id)) {
+            throw std::runtime_error{"'" + old_file +
+                                     "' is not osmborder csv output"};
+        }
+        row.hash = hash(begin, end);
+        row.seen = false;
+        m_old_rows.push_back(row);
+    }
+    if (in.bad()) {
+        throw std::runtime_error{"Error reading '" + old_file + "'"};
+    }
+    std::sort(m_old_rows.begin(), m_old_rows.end(),
+              [](const old_row &a, const old_row &b) { return a.id < b.id; });
+}
+
+uint64_t RowDiff::hash(const char *begin, const char *end)
+{
+    // 64 bit FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (const char *c = begin; c != end; ++c) {
+        h ^= static_cast<unsigned char>(*c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+bool RowDiff::parse_id(const char *begin, const char *end,
+                       osmium::object_id_type &id)
+{
+    const char *c = begin;
+    const bool negative = c != end && *c == '-';
+    if (negative) {
+        ++c;
+    }
+    if (c == end || *c < '0' || *c > '9') {
+        return false;
+    }
+    uint64_t value = 0;
+    for (; c != end && *c >= '0' && *c <= '9'; ++c) {
+        value = value * 10 + static_cast<uint64_t>(*c - '0');
+    }
+    if (c == end || *c != '\t') {
+        return false;
+    }
+    id = negative ? -static_cast<osmium::object_id_type>(value)
+                  : static_cast<osmium::object_id_type>(value);
+    return true;
+}
+
+void RowDiff::add_rows(const std::string &data)
+{
+    const char *begin = data.data();
+    const char *const data_end = begin + data.size();
+    while (begin != data_end) {
+        const char *end = std::find(begin, data_end, '\n');
+        osmium::object_id_type id = 0;
+        if (parse_id(begin, end, id)) {
+            const auto old = std::lower_bound(
+                m_old_rows.begin(), m_old_rows.end(), id,
+                [](const old_row &r, osmium::object_id_type i) {
+                    return r.id < i;
+                });
+            const bool found = old != m_old_rows.end() && old->id == id;
+            if (found) {
+                old->seen = true;
+            }
+            if (!found || old->hash != hash(begin, end)) {
+                if (found) {
+                    m_deleted.push_back(id);
+                }
+                m_insert.append(begin, end);
+                m_insert += '\n';
+                ++m_inserted;
+            }
+        }
+        begin = (end == data_end) ? end : end + 1;
+    }
+}
+
+void RowDiff::write_sql(OutputWriter &out, const std::string &table)
+{
+    for (const auto &row : m_old_rows) {
+        if (!row.seen) {
+            m_deleted.push_back(row.id);
+        }
+    }
+    std::sort(m_deleted.begin(), m_deleted.end());
+
+    std::string sql = "BEGIN;\n";
+    for (size_t i = 0; i < m_deleted.size(); i += ids_per_delete) {
+        const size_t end = std::min(m_deleted.size(), i + ids_per_delete);
+        sql += "DELETE FROM " + table + " WHERE osm_id = ANY ('{";
+        for (size_t j = i; j < end; ++j) {
+            if (j != i) {
+                sql += ',';
+            }
+            append_int(sql, m_deleted[j]);
+        }
+        sql += "}'::bigint[]);\n";
+    }
+    if (m_inserted) {
+        sql += "COPY " + table + " FROM STDIN;\n";
+        out.write(std::move(sql));
+        out.write(std::move(m_insert));
+        m_insert = std::string();
+        sql = "\\.\n";
+    }
+    sql += "COMMIT;\n";
+    out.write(std::move(sql));
+}
@@ -0,0 +1,80 @@
+#ifndef ROWDIFF_HPP
+#define ROWDIFF_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+#include "output.hpp"
+
+/**
+ * Compares csv output with the output of an earlier run, keyed by way ID,
+ * and writes an SQL script that turns the old table contents into the new
+ * ones in a single transaction.
+ *
+ * Only a hash of each old row is kept, so memory use is a small fraction
+ * of the size of the old file. New rows are only kept if they changed.
+ */
+class RowDiff
+{
+public:
+    /**
+     * Read the rows of the old output. Throws std::runtime_error if the
+     * file can't be read or doesn't look like osmborder csv output.
+     */
+    explicit RowDiff(const std::string &old_file);
+
+    /// Compare rows of new output. data must hold complete rows.
+    void add_rows(const std::string &data);
+
+    /// Write the SQL script for table. Call after all rows were added.
+    void write_sql(OutputWriter &out, const std::string &table);
+
+    /// Number of rows to delete, including changed ones
+    size_t deleted() const { return m_deleted.size(); }
+
+    /// Number of rows to insert, including changed ones
+    size_t inserted() const { return m_inserted; }
+
+private:
+    struct old_row
+    {
+        osmium::object_id_type id;
+        uint64_t hash;
+        bool seen;
+    };
+
+    // Sorted by ID
+    std::vector<old_row> m_old_rows;
+    std::vector<osmium::object_id_type> m_deleted;
+    std::string m_insert;
+    size_t m_inserted = 0;
+
+    static uint64_t hash(const char *begin, const char *end);
+    static bool parse_id(const char *begin, const char *end,
+                         osmium::object_id_type &id);
+};
+
+#endif // ROWDIFF_HPP
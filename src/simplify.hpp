@@ -0,0 +1,102 @@
+#ifndef SIMPLIFY_HPP
+#define SIMPLIFY_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <osmium/geom/coordinates.hpp>
+
+/**
+ * Simplify a line with the Douglas-Peucker algorithm, keeping all points
+ * further than tolerance from the simplified line. The first and last
+ * points are always kept.
+ */
+inline std::vector<osmium::geom::Coordinates>
+simplify_line(const std::vector<osmium::geom::Coordinates> &coordinates,
+              double tolerance)
+{
+    const size_t size = coordinates.size();
+    if (size < 3) {
+        return coordinates;
+    }
+
+    const double tolerance_squared = tolerance * tolerance;
+    std::vector<bool> keep(size, false);
+    keep[0] = true;
+    keep[size - 1] = true;
+
+    // Ranges still to look at, an explicit stack to not recurse on long
+    // lines
+    std::vector<std::pair<size_t, size_t>> ranges{{0, size - 1}};
+    while (!ranges.empty()) {
+        const size_t first = ranges.back().first;
+        const size_t last = ranges.back().second;
+        ranges.pop_back();
+
+        const auto &a = coordinates[first];
+        const auto &b = coordinates[last];
+        const double dx = b.x - a.x;
+        const double dy = b.y - a.y;
+        const double length_squared = dx * dx + dy * dy;
+
+        double max_distance = 0.0;
+        size_t farthest = first;
+        for (size_t i = first + 1; i < last; ++i) {
+            const auto &p = coordinates[i];
+            // Squared distance from p to the segment from a to b
+            double t = 0.0;
+            if (length_squared > 0.0) {
+                t = ((p.x - a.x) * dx + (p.y - a.y) * dy) / length_squared;
+                t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+            }
+            const double ex = a.x + t * dx - p.x;
+            const double ey = a.y + t * dy - p.y;
+            const double distance = ex * ex + ey * ey;
+            if (distance > max_distance) {
+                max_distance = distance;
+                farthest = i;
+            }
+        }
+
+        if (max_distance > tolerance_squared) {
+            keep[farthest] = true;
+            if (farthest - first > 1) {
+                ranges.emplace_back(first, farthest);
+            }
+            if (last - farthest > 1) {
+                ranges.emplace_back(farthest, last);
+            }
+        }
+    }
+
+    std::vector<osmium::geom::Coordinates> simplified;
+    for (size_t i = 0; i < size; ++i) {
+        if (keep[i]) {
+            simplified.push_back(coordinates[i]);
+        }
+    }
+    return simplified;
+}
+
+#endif // SIMPLIFY_HPP
@@ -0,0 +1,288 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "idset.hpp"
+#include "state.hpp"
+
+namespace {
+
+const char state_file_name[] = "osmborder.state";
+const char magic[8] = {'O', 'S', 'M', 'B', 'S', 'T', 'A', 'T'};
+// Version 1 had no relation flags
+const uint32_t state_version = 2;
+
+// Everything is stored little endian
+class StateWriter
+{
+    std::ofstream m_file;
+    std::string m_buffer;
+
+    void flush_buffer()
+    {
+        m_file.write(m_buffer.data(),
+                     static_cast<std::streamsize>(m_buffer.size()));
+        m_buffer.clear();
+    }
+
+public:
+    explicit StateWriter(const std::string &filename)
+    : m_file(filename, std::ios::binary | std::ios::trunc)
+    {
+        if (!m_file) {
+            throw std::runtime_error{"Can't create state file '" + filename +
+                                     "': " + std::strerror(errno)};
+        }
+    }
+
+    void raw(const char *data, size_t size)
+    {
+        m_buffer.append(data, size);
+        if (m_buffer.size() >= 1024 * 1024) {
+            flush_buffer();
+        }
+    }
+
+    void uint(uint64_t value, int bytes)
+    {
+        char data[8];
+        for (int i = 0; i < bytes; ++i) {
+            data[i] = static_cast<char>(value >> (8 * i));
+        }
+        raw(data, static_cast<size_t>(bytes));
+    }
+
+    void int32(int32_t value) { uint(static_cast<uint32_t>(value), 4); }
+    void int64(int64_t value) { uint(static_cast<uint64_t>(value), 8); }
+
+    /// Returns false if anything failed
+    bool close()
+    {
+        flush_buffer();
+        m_file.close();
+        return !m_file.fail();
+    }
+};
+
+class StateReader
+{
+    std::ifstream m_file;
+    std::string m_filename;
+
+public:
+    explicit StateReader(const std::string &filename)
+    : m_file(filename, std::ios::binary), m_filename(filename)
+    {
+        if (!m_file) {
+            throw std::runtime_error{"Can't open state file '" + filename +
+                                     "': " + std::strerror(errno)};
+        }
+    }
+
+    void raw(char *data, size_t size)
+    {
+        if (!m_file.read(data, static_cast<std::streamsize>(size))) {
+            throw std::runtime_error{"State file '" + m_filename +
+                                     "' is truncated"};
+        }
+    }
+
+    uint64_t uint(int bytes)
+    {
+        unsigned char data[8];
+        raw(reinterpret_cast<char *>(data), static_cast<size_t>(bytes));
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            value |= uint64_t(data[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    int32_t int32() { return static_cast<int32_t>(uint(4)); }
+    int64_t int64() { return static_cast<int64_t>(uint(8)); }
+};
+
+} // anonymous namespace
+
+void BorderState::add_node(osmium::object_id_type id,
+                           osmium::Location location)
+{
+    m_nodes.push_back(node{id, location.x(), location.y()});
+}
+
+void BorderState::prepare_nodes()
+{
+    if (m_sorted_nodes == m_nodes.size()) {
+        return;
+    }
+    const auto by_id = [](const node &a, const node &b) { return a.id < b.id; };
+    const auto middle = m_nodes.begin() + static_cast<long>(m_sorted_nodes);
+    std::stable_sort(middle, m_nodes.end(), by_id);
+    std::inplace_merge(m_nodes.begin(), middle, m_nodes.end(), by_id);
+
+    // Merging is stable, so of several entries for a node the last one is
+    // the one added last
+    auto out = m_nodes.begin();
+    for (auto it = m_nodes.begin(); it != m_nodes.end(); ++it) {
+        if (it + 1 == m_nodes.end() || (it + 1)->id != it->id) {
+            *out++ = *it;
+        }
+    }
+    m_nodes.erase(out, m_nodes.end());
+    m_sorted_nodes = m_nodes.size();
+}
+
+osmium::Location BorderState::get_location(osmium::object_id_type id) const
+{
+    const auto end = m_nodes.begin() + static_cast<long>(m_sorted_nodes);
+    const auto it = std::lower_bound(
+        m_nodes.begin(), end, id,
+        [](const node &n, osmium::object_id_type i) { return n.id < i; });
+    if (it == end || it->id != id) {
+        return osmium::Location{};
+    }
+    return osmium::Location{it->x, it->y};
+}
+
+void BorderState::remove_unused_nodes()
+{
+    prepare_nodes();
+    IdSet used;
+    for (const auto &w : m_ways) {
+        for (const auto id : w.second.nodes) {
+            used.set(id);
+        }
+    }
+    m_nodes.erase(std::remove_if(m_nodes.begin(), m_nodes.end(),
+                                 [&](const node &n) { return !used.get(n.id); }),
+                  m_nodes.end());
+    m_sorted_nodes = m_nodes.size();
+}
+
+void BorderState::load(const std::string &directory)
+{
+    const std::string filename = directory + "/" + state_file_name;
+    StateReader in(filename);
+
+    char file_magic[sizeof(magic)];
+    in.raw(file_magic, sizeof(file_magic));
+    if (std::memcmp(file_magic, magic, sizeof(magic)) != 0) {
+        throw std::runtime_error{"'" + filename +
+                                 "' is not an osmborder state file"};
+    }
+    const uint64_t version = in.uint(4);
+    if (version != state_version && version != 1) {
+        throw std::runtime_error{"State file '" + filename +
+                                 "' has an unsupported version"};
+    }
+
+    m_relations.clear();
+    for (uint64_t n = in.uint(8); n > 0; --n) {
+        const osmium::object_id_type id = in.int64();
+        relation &r = m_relations[id];
+        r.admin_level = in.int32();
+        r.flags = version > 1 ? static_cast<uint8_t>(in.uint(1)) : 0;
+        r.ways.resize(in.uint(8));
+        for (auto &way_id : r.ways) {
+            way_id = in.int64();
+        }
+    }
+
+    m_ways.clear();
+    for (uint64_t n = in.uint(8); n > 0; --n) {
+        const osmium::object_id_type id = in.int64();
+        way &w = m_ways[id];
+        const uint64_t flags = in.uint(1);
+        w.disputed = flags & 1;
+        w.maritime = flags & 2;
+        w.nodes.resize(in.uint(8));
+        for (auto &node_id : w.nodes) {
+            node_id = in.int64();
+        }
+    }
+
+    m_nodes.resize(in.uint(8));
+    for (auto &n : m_nodes) {
+        n.id = in.int64();
+        n.x = in.int32();
+        n.y = in.int32();
+    }
+    m_sorted_nodes = m_nodes.size();
+}
+
+void BorderState::save(const std::string &directory) const
+{
+    if (m_sorted_nodes != m_nodes.size()) {
+        throw std::logic_error{"BorderState::prepare_nodes() not called"};
+    }
+
+    const std::string filename = directory + "/" + state_file_name;
+    const std::string tmp_filename = filename + ".tmp";
+    StateWriter out(tmp_filename);
+
+    out.raw(magic, sizeof(magic));
+    out.uint(state_version, 4);
+
+    out.uint(m_relations.size(), 8);
+    for (const auto &r : m_relations) {
+        out.int64(r.first);
+        out.int32(r.second.admin_level);
+        out.uint(r.second.flags, 1);
+        out.uint(r.second.ways.size(), 8);
+        for (const auto id : r.second.ways) {
+            out.int64(id);
+        }
+    }
+
+    out.uint(m_ways.size(), 8);
+    for (const auto &w : m_ways) {
+        out.int64(w.first);
+        out.uint((w.second.disputed ? 1 : 0) | (w.second.maritime ? 2 : 0),
+                 1);
+        out.uint(w.second.nodes.size(), 8);
+        for (const auto id : w.second.nodes) {
+            out.int64(id);
+        }
+    }
+
+    out.uint(m_nodes.size(), 8);
+    for (const auto &n : m_nodes) {
+        out.int64(n.id);
+        out.int32(n.x);
+        out.int32(n.y);
+    }
+
+    if (!out.close()) {
+        throw std::runtime_error{"Error writing state file '" + tmp_filename +
+                                 "'"};
+    }
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        throw std::runtime_error{"Can't rename '" + tmp_filename + "' to '" +
+                                 filename + "': " + std::strerror(errno)};
+    }
+}
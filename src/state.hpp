@@ -0,0 +1,114 @@
+#ifndef STATE_HPP
+#define STATE_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <osmium/osm/location.hpp>
+#include <osmium/osm/types.hpp>
+
+/**
+ * What osmborder needs to remember between runs to apply change files:
+ * the admin relations with their levels and member ways, the border ways
+ * with their node lists, and the locations of the nodes of those ways.
+ *
+ * Node locations are kept in a vector sorted by ID, since there are far
+ * more of them than of ways or relations and they hardly ever change.
+ */
+class BorderState
+{
+public:
+    struct relation
+    {
+        /// -1 for relations that only pass TagRules flags to their ways
+        int admin_level;
+        uint8_t flags;
+        std::vector<osmium::object_id_type> ways;
+    };
+
+    struct way
+    {
+        bool disputed;
+        bool maritime;
+        std::vector<osmium::object_id_type> nodes;
+    };
+
+    typedef std::unordered_map<osmium::object_id_type, relation>
+        relation_map;
+    typedef std::unordered_map<osmium::object_id_type, way> way_map;
+
+    relation_map &relations() { return m_relations; }
+    const relation_map &relations() const { return m_relations; }
+
+    way_map &ways() { return m_ways; }
+    const way_map &ways() const { return m_ways; }
+
+    /**
+     * Add or replace the location of a node. Lookups only see it after
+     * prepare_nodes() has been called.
+     */
+    void add_node(osmium::object_id_type id, osmium::Location location);
+
+    /// Sort the nodes added since the last call. Later additions win.
+    void prepare_nodes();
+
+    /// Location of a node, or an invalid location if it isn't known.
+    osmium::Location get_location(osmium::object_id_type id) const;
+
+    /// Number of node locations
+    size_t num_nodes() const { return m_nodes.size(); }
+
+    /// Drop the locations of nodes that none of the ways use any more.
+    void remove_unused_nodes();
+
+    /**
+     * Load the state from a directory. Throws std::runtime_error if it
+     * isn't there or can't be read.
+     */
+    void load(const std::string &directory);
+
+    /**
+     * Save the state into a directory, which must exist. The file is
+     * written under a temporary name and renamed, so an interrupted run
+     * leaves the old state in place. Throws std::runtime_error on errors.
+     */
+    void save(const std::string &directory) const;
+
+private:
+    struct node
+    {
+        osmium::object_id_type id;
+        int32_t x;
+        int32_t y;
+    };
+
+    relation_map m_relations;
+    way_map m_ways;
+    // Sorted by ID up to m_sorted_nodes, then in the order they were added
+    std::vector<node> m_nodes;
+    size_t m_sorted_nodes = 0;
+};
+
+#endif // STATE_HPP
@@ -0,0 +1,151 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <ostream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#else
+#include <windows.h>
+#endif
+
+#include <osmium/util/memory.hpp>
+
+#include "stats.hpp"
+
+namespace {
+
+/**
+ * User and system CPU time used by all threads of the process so far.
+ * std::clock() can't be used for this, as it is the wall time on Windows.
+ */
+double process_cpu_seconds()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           static_cast<double>(usage.ru_utime.tv_usec +
+                               usage.ru_stime.tv_usec) /
+               1e6;
+#else
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel,
+                         &user)) {
+        return 0.0;
+    }
+    const auto ticks = [](const FILETIME &t) {
+        return (static_cast<uint64_t>(t.dwHighDateTime) << 32) |
+               t.dwLowDateTime;
+    };
+    // FILETIME counts in units of 100 ns
+    return static_cast<double>(ticks(kernel) + ticks(user)) / 1e7;
+#endif
+}
+
+double cpu_seconds_since(double start)
+{
+    return process_cpu_seconds() - start;
+}
+
+void write_json_string(std::ostream &out, const std::string &text)
+{
+    static const char digits[] = "0123456789abcdef";
+    out << '"';
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u00" << digits[(c >> 4) & 0xf] << digits[c & 0xf];
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+} // anonymous namespace
+
+Stats::Stats()
+: m_run_start(clock_type::now()), m_run_cpu_start(process_cpu_seconds())
+{
+}
+
+PassStats &Stats::start_pass(const std::string &name)
+{
+    m_passes.emplace_back();
+    m_passes.back().name = name;
+    m_pass_start = clock_type::now();
+    m_pass_cpu_start = process_cpu_seconds();
+    return m_passes.back();
+}
+
+void Stats::end_pass()
+{
+    PassStats &p = m_passes.back();
+    p.wall_seconds =
+        std::chrono::duration<double>(clock_type::now() - m_pass_start)
+            .count();
+    p.cpu_seconds = cpu_seconds_since(m_pass_cpu_start);
+    p.peak_memory_mb = osmium::MemoryUsage().peak();
+}
+
+void Stats::write_json(std::ostream &out, unsigned int warnings,
+                       unsigned int errors) const
+{
+    const double wall_seconds =
+        std::chrono::duration<double>(clock_type::now() - m_run_start)
+            .count();
+
+    out << "{\n  \"version\": ";
+    write_json_string(out, OSMBORDER_VERSION);
+    out << ",\n  \"wall_seconds\": " << wall_seconds
+        << ",\n  \"cpu_seconds\": " << cpu_seconds_since(m_run_cpu_start)
+        << ",\n  \"peak_memory_mb\": " << osmium::MemoryUsage().peak()
+        << ",\n  \"warnings\": " << warnings
+        << ",\n  \"errors\": " << errors
+        << ",\n  \"geometry_errors\": {\"missing_location\": "
+        << m_geometry_errors.missing_location
+        << ", \"too_few_points\": " << m_geometry_errors.too_few_points
+        << ", \"total\": " << m_geometry_errors.total() << "}"
+        << ",\n  \"passes\": [";
+    for (size_t i = 0; i < m_passes.size(); ++i) {
+        const PassStats &p = m_passes[i];
+        out << (i ? "," : "") << "\n    {\"name\": ";
+        write_json_string(out, p.name);
+        out << ", \"wall_seconds\": " << p.wall_seconds
+            << ", \"cpu_seconds\": " << p.cpu_seconds
+            << ", \"bytes_read\": " << p.bytes_read << ", \"blobs_read\": ";
+        if (p.blobs_read < 0) {
+            out << "null";
+        } else {
+            out << p.blobs_read;
+        }
+        out << ", \"objects_seen\": " << p.objects_seen
+            << ", \"objects_kept\": " << p.objects_kept
+            << ", \"index_bytes\": " << p.index_bytes
+            << ", \"peak_memory_mb\": " << p.peak_memory_mb << "}";
+    }
+    out << "\n  ]\n}\n";
+}
@@ -22,16 +22,86 @@
 
 */
 
-struct Stats
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/// Ways that couldn't be turned into lines, by reason.
+struct GeometryErrors
+{
+    /// A node of the way is missing from the input
+    uint64_t missing_location = 0;
+    /// Fewer than two distinct points
+    uint64_t too_few_points = 0;
+
+    GeometryErrors &operator+=(const GeometryErrors &other)
+    {
+        missing_location += other.missing_location;
+        too_few_points += other.too_few_points;
+        return *this;
+    }
+
+    uint64_t total() const { return missing_location + too_few_points; }
+};
+
+/// Metrics for one pass over the input or another stage of a run.
+struct PassStats
+{
+    std::string name;
+    double wall_seconds = 0.0;
+    /// User and system CPU time of all threads of the process
+    double cpu_seconds = 0.0;
+    /// Bytes of input the pass read, as far as it is known
+    uint64_t bytes_read = 0;
+    /// PBF blobs read, or -1 if unknown because there is no blob index
+    int64_t blobs_read = -1;
+    uint64_t objects_seen = 0;
+    uint64_t objects_kept = 0;
+    /// Memory used by what the pass builds for the later ones
+    uint64_t index_bytes = 0;
+    /// Peak memory of the process at the end of the pass, in MBytes
+    int peak_memory_mb = 0;
+};
+
+/**
+ * Counts and timings for a whole run, which can be written out as JSON.
+ * Passes are timed from start_pass() to end_pass(), and their other
+ * fields are filled in by the caller.
+ */
+class Stats
 {
-    unsigned int ways;
-    unsigned int unconnected_nodes;
-    unsigned int rings;
-    unsigned int rings_from_single_way;
-    unsigned int rings_fixed;
-    unsigned int rings_turned_around;
-    unsigned int land_polygons_before_split;
-    unsigned int land_polygons_after_split;
+public:
+    Stats();
+
+    /// Start timing the next pass and return it.
+    PassStats &start_pass(const std::string &name);
+
+    /// The pass started last
+    PassStats &pass() { return m_passes.back(); }
+
+    /// Stop timing the pass started last and note the peak memory.
+    void end_pass();
+
+    GeometryErrors &geometry_errors() { return m_geometry_errors; }
+
+    /**
+     * Write everything as a JSON object, along with the totals for the
+     * whole run and the number of warnings and errors.
+     */
+    void write_json(std::ostream &out, unsigned int warnings,
+                    unsigned int errors) const;
+
+private:
+    typedef std::chrono::steady_clock clock_type;
+
+    clock_type::time_point m_run_start;
+    double m_run_cpu_start;
+    clock_type::time_point m_pass_start;
+    double m_pass_cpu_start = 0.0;
+    std::vector<PassStats> m_passes;
+    GeometryErrors m_geometry_errors;
 };
 
 #endif // STATS_HPP
@@ -0,0 +1,289 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "tagrules.hpp"
+#include "waylevels.hpp"
+
+namespace {
+
+// What osmborder always did: administrative boundaries at levels 2 to 12,
+// and a few common ways of tagging disputed and maritime borders.
+const char default_rules[] = "border boundary=administrative\n"
+                             "admin_level admin_level 2-12\n"
+                             "way disputed disputed=yes\n"
+                             "way disputed dispute=yes\n"
+                             "way disputed border_status=dispute\n"
+                             "way disputed disputed_by=*\n"
+                             "way maritime maritime=yes\n"
+                             "way maritime natural=coastline\n"
+                             "way maritime boundary_type=maritime\n";
+
+// Bits in the relation rules besides the flags
+const uint32_t border_bit = 1u << 8;
+const uint32_t level_bit = 1u << 9;
+
+const uint32_t flag_mask = 0xff;
+
+} // anonymous namespace
+
+uint32_t TagRules::matcher::hash(const char *key)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (; *key; ++key) {
+        h = (h ^ static_cast<unsigned char>(*key)) * 16777619u;
+    }
+    return h;
+}
+
+const TagRules::matcher::key_rules *
+TagRules::matcher::find(const char *key) const
+{
+    if (m_table.empty()) {
+        return nullptr;
+    }
+    const size_t mask = m_table.size() - 1;
+    for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+        const int32_t index = m_table[i];
+        if (index < 0) {
+            return nullptr;
+        }
+        if (m_keys[index].key == key) {
+            return &m_keys[index];
+        }
+    }
+}
+
+void TagRules::matcher::clear()
+{
+    m_keys.clear();
+    m_table.clear();
+}
+
+void TagRules::matcher::add(const std::string &key, const std::string &value,
+                            uint32_t bits)
+{
+    const key_rules *existing = find(key.c_str());
+    if (existing == nullptr) {
+        m_keys.emplace_back();
+        m_keys.back().key = key;
+
+        // Keep the table at most half full
+        if (m_keys.size() * 2 > m_table.size()) {
+            m_table.assign(std::max<size_t>(16, m_table.size() * 2), -1);
+            for (size_t k = 0; k < m_keys.size(); ++k) {
+                const size_t mask = m_table.size() - 1;
+                size_t i = hash(m_keys[k].key.c_str()) & mask;
+                while (m_table[i] >= 0) {
+                    i = (i + 1) & mask;
+                }
+                m_table[i] = static_cast<int32_t>(k);
+            }
+        } else {
+            const size_t mask = m_table.size() - 1;
+            size_t i = hash(key.c_str()) & mask;
+            while (m_table[i] >= 0) {
+                i = (i + 1) & mask;
+            }
+            m_table[i] = static_cast<int32_t>(m_keys.size() - 1);
+        }
+        existing = &m_keys.back();
+    }
+
+    key_rules &rules = m_keys[existing - m_keys.data()];
+    if (value.empty()) {
+        rules.any_bits |= bits;
+        return;
+    }
+    for (auto &v : rules.values) {
+        if (v.first == value) {
+            v.second |= bits;
+            return;
+        }
+    }
+    rules.values.emplace_back(value, bits);
+}
+
+TagRules::TagRules()
+{
+    std::istringstream in{default_rules};
+    parse(in, "built-in rules");
+}
+
+void TagRules::load(const std::string &filename)
+{
+    std::ifstream in{filename};
+    if (!in) {
+        throw std::runtime_error{"Can't open rules file '" + filename + "'"};
+    }
+    parse(in, filename);
+}
+
+void TagRules::parse(std::istream &in, const std::string &source)
+{
+    m_way_rules.clear();
+    m_relation_rules.clear();
+    m_level_key.clear();
+
+    bool have_border = false;
+    std::string line;
+    for (int line_number = 1; std::getline(in, line); ++line_number) {
+        const auto error = [&](const std::string &message) {
+            return std::runtime_error{source + ":" +
+                                      std::to_string(line_number) + ": " +
+                                      message};
+        };
+
+        const auto comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream words{line};
+        std::string kind;
+        if (!(words >> kind)) {
+            continue;
+        }
+
+        std::string flag_name;
+        if (kind == "way" || kind == "relation") {
+            words >> flag_name;
+        }
+        std::string tag;
+        std::string range;
+        words >> tag;
+        if (kind == "admin_level") {
+            words >> range;
+        }
+        std::string extra;
+        if (tag.empty() || (kind == "admin_level" && range.empty()) ||
+            words >> extra) {
+            throw error("wrong number of words");
+        }
+
+        if (kind == "admin_level") {
+            int min_level;
+            int max_level;
+            char dash;
+            std::istringstream levels{range};
+            if (!(levels >> min_level >> dash >> max_level) || dash != '-' ||
+                levels >> extra || min_level < 0 ||
+                max_level > WayLevels::max_level || min_level > max_level) {
+                throw error("admin levels must be MIN-MAX, from 0 to " +
+                            std::to_string(WayLevels::max_level));
+            }
+            if (!m_level_key.empty()) {
+                throw error("admin_level given twice");
+            }
+            m_level_key = tag;
+            m_min_level = min_level;
+            m_max_level = max_level;
+            m_relation_rules.add(tag, "", level_bit);
+            continue;
+        }
+
+        const auto equals = tag.find('=');
+        if (equals == std::string::npos || equals == 0 ||
+            equals + 1 == tag.size()) {
+            throw error("expected KEY=VALUE, not '" + tag + "'");
+        }
+        const std::string key = tag.substr(0, equals);
+        std::string value = tag.substr(equals + 1);
+        if (value == "*") {
+            value.clear();
+        }
+
+        if (kind == "border") {
+            m_relation_rules.add(key, value, border_bit);
+            have_border = true;
+            continue;
+        }
+
+        uint8_t flag;
+        if (flag_name == "disputed") {
+            flag = flag_disputed;
+        } else if (flag_name == "maritime") {
+            flag = flag_maritime;
+        } else if (kind == "way" || kind == "relation") {
+            throw error("unknown flag '" + flag_name + "'");
+        } else {
+            throw error("unknown rule '" + kind + "'");
+        }
+        if (kind == "way") {
+            m_way_rules.add(key, value, flag);
+        } else {
+            m_relation_rules.add(key, value, flag);
+        }
+    }
+
+    if (!have_border) {
+        throw std::runtime_error{source + ": no border rule"};
+    }
+    if (m_level_key.empty()) {
+        throw std::runtime_error{source + ": no admin_level rule"};
+    }
+}
+
+TagRules::relation_class
+TagRules::classify_relation(const osmium::TagList &tags) const
+{
+    uint32_t bits = 0;
+    const char *level = nullptr;
+    for (const auto &tag : tags) {
+        const uint32_t tag_bits =
+            m_relation_rules.match(tag.key(), tag.value());
+        if (tag_bits & level_bit) {
+            level = tag.value();
+        }
+        bits |= tag_bits;
+    }
+
+    relation_class result;
+    result.border = bits & border_bit;
+    result.admin_level =
+        result.border && level ? parse_admin_level(level) : -1;
+    result.flags = static_cast<uint8_t>(bits & flag_mask);
+    return result;
+}
+
+int TagRules::parse_admin_level(const char *value) const
+{
+    // Only plain decimal numbers, no signs, spaces or leading zeros
+    if (*value < '0' || *value > '9' || (value[0] == '0' && value[1])) {
+        return -1;
+    }
+    int level = 0;
+    for (const char *c = value; *c; ++c) {
+        if (*c < '0' || *c > '9' || level > m_max_level) {
+            return -1;
+        }
+        level = level * 10 + (*c - '0');
+    }
+    if (level < m_min_level || level > m_max_level) {
+        return -1;
+    }
+    return level;
+}
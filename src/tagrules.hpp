@@ -0,0 +1,151 @@
+#ifndef TAGRULES_HPP
+#define TAGRULES_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <osmium/osm/tag.hpp>
+
+/**
+ * The rules deciding which relations are borders, which admin levels are
+ * used, and which ways are disputed or maritime. They are read from a rules
+ * file, or are the built-in ones, and compiled into a hash table keyed by
+ * tag key, so classifying an object is a single pass over its tags with one
+ * lookup per tag.
+ *
+ * The rules file has one rule per line, with # starting a comment:
+ *
+ *   border KEY=VALUE            relations with this tag are borders
+ *   admin_level KEY MIN-MAX     tag with the level and the levels used
+ *   way FLAG KEY=VALUE          ways with this tag get FLAG
+ *   relation FLAG KEY=VALUE     member ways of relations with this tag get
+ *                               FLAG
+ *
+ * FLAG is disputed or maritime and a VALUE of * matches any value. A
+ * relation is a border if any border rule matches.
+ *
+ * Once built, any number of threads can use the rules at the same time.
+ */
+class TagRules
+{
+public:
+    enum flag : uint8_t
+    {
+        flag_disputed = 1,
+        flag_maritime = 2
+    };
+
+    /// What the rules make of a relation
+    struct relation_class
+    {
+        /// Did a border rule match?
+        bool border;
+        /// Admin level if it is a border with a usable level, otherwise -1
+        int admin_level;
+        /// Flags for the member ways
+        uint8_t flags;
+    };
+
+    /// The built-in rules.
+    TagRules();
+
+    /**
+     * Replace the rules with those from a rules file. Throws
+     * std::runtime_error if it can't be read or has errors.
+     */
+    void load(const std::string &filename);
+
+    /// Flags a way gets from its own tags
+    uint8_t way_flags(const osmium::TagList &tags) const
+    {
+        uint8_t flags = 0;
+        for (const auto &tag : tags) {
+            flags |= m_way_rules.match(tag.key(), tag.value());
+        }
+        return flags;
+    }
+
+    relation_class classify_relation(const osmium::TagList &tags) const;
+
+    /**
+     * Get the numeric level from an admin level tag value, or -1 if it
+     * isn't one of the levels used.
+     */
+    int parse_admin_level(const char *value) const;
+
+private:
+    // Maps tags to bit sets, from the rules for one kind of object
+    class matcher
+    {
+        struct key_rules
+        {
+            std::string key;
+            // Bits for any value of the key
+            uint32_t any_bits = 0;
+            std::vector<std::pair<std::string, uint32_t>> values;
+        };
+
+        std::vector<key_rules> m_keys;
+        // Open addressing hash table of indexes into m_keys, -1 if empty
+        std::vector<int32_t> m_table;
+
+        static uint32_t hash(const char *key);
+
+        const key_rules *find(const char *key) const;
+
+    public:
+        void clear();
+
+        /// Add a rule, an empty value matches any value.
+        void add(const std::string &key, const std::string &value,
+                 uint32_t bits);
+
+        uint32_t match(const char *key, const char *value) const
+        {
+            const key_rules *rules = find(key);
+            if (rules == nullptr) {
+                return 0;
+            }
+            uint32_t bits = rules->any_bits;
+            for (const auto &v : rules->values) {
+                if (v.first == value) {
+                    bits |= v.second;
+                }
+            }
+            return bits;
+        }
+    };
+
+    void parse(std::istream &in, const std::string &source);
+
+    matcher m_way_rules;
+    // With the flags in the low bits, plus border_bit and level_bit
+    matcher m_relation_rules;
+    std::string m_level_key;
+    int m_min_level;
+    int m_max_level;
+};
+
+#endif // TAGRULES_HPP
@@ -0,0 +1,254 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <osmium/io/any_input.hpp>
+#include <osmium/osm.hpp>
+
+#include "adminhandler.hpp"
+#include "idset.hpp"
+#include "update.hpp"
+#include "waylevels.hpp"
+
+namespace {
+
+/**
+ * Remember obj if it is the newest version of its object seen so far.
+ * Change files are in order, so of equal versions the later one wins.
+ */
+template <typename T>
+void keep_newest(std::unordered_map<osmium::object_id_type, const T *> &map,
+                 const T &obj)
+{
+    const T *&newest = map[obj.id()];
+    if (newest == nullptr || obj.version() >= newest->version()) {
+        newest = &obj;
+    }
+}
+
+} // anonymous namespace
+
+void StateUpdater::apply(const osmium::io::File &change_file)
+{
+    osmium::io::Reader reader(change_file, osmium::osm_entity_bits::nwr);
+    while (osmium::memory::Buffer buffer = reader.read()) {
+        m_buffers.push_back(std::move(buffer));
+    }
+    reader.close();
+
+    std::unordered_map<osmium::object_id_type, const osmium::Node *> nodes;
+    std::unordered_map<osmium::object_id_type, const osmium::Way *> ways;
+    std::unordered_map<osmium::object_id_type, const osmium::Relation *>
+        relations;
+    for (auto &buffer : m_buffers) {
+        for (auto it = buffer.begin<osmium::Node>();
+             it != buffer.end<osmium::Node>(); ++it) {
+            keep_newest(nodes, *it);
+        }
+        for (auto it = buffer.begin<osmium::Way>();
+             it != buffer.end<osmium::Way>(); ++it) {
+            keep_newest(ways, *it);
+        }
+        for (auto it = buffer.begin<osmium::Relation>();
+             it != buffer.end<osmium::Relation>(); ++it) {
+            keep_newest(relations, *it);
+        }
+    }
+
+    // Nodes of border ways that moved or were deleted
+    IdSet moved_nodes;
+    for (const auto &n : nodes) {
+        const osmium::Location old_location =
+            m_state.get_location(n.first);
+        if (!old_location.valid()) {
+            continue;
+        }
+        const osmium::Location location =
+            n.second->visible() ? n.second->location() : osmium::Location{};
+        if (location != old_location) {
+            m_state.add_node(n.first, location);
+            moved_nodes.set(n.first);
+        }
+    }
+
+    for (const auto &r : relations) {
+        const auto old = m_state.relations().find(r.first);
+        if (old != m_state.relations().end()) {
+            m_affected.insert(old->second.ways.begin(),
+                              old->second.ways.end());
+            m_state.relations().erase(old);
+        }
+
+        const osmium::Relation &relation = *r.second;
+        if (!relation.visible()) {
+            continue;
+        }
+        const TagRules::relation_class rc =
+            m_rules.classify_relation(relation.tags());
+        if (rc.admin_level < 0 && rc.flags == 0) {
+            continue;
+        }
+        BorderState::relation &state = m_state.relations()[r.first];
+        state.admin_level = rc.admin_level;
+        state.flags = rc.flags;
+        for (const auto &rm : relation.members()) {
+            if (rm.type() == osmium::item_type::way) {
+                state.ways.push_back(rm.ref());
+                m_affected.insert(rm.ref());
+            }
+        }
+    }
+
+    // Ways of relations that only have flags aren't border ways
+    IdSet member_ways;
+    for (const auto &r : m_state.relations()) {
+        if (r.second.admin_level < 0) {
+            continue;
+        }
+        for (const auto id : r.second.ways) {
+            member_ways.set(id);
+        }
+    }
+
+    for (const auto &w : ways) {
+        const osmium::Way &way = *w.second;
+        const auto old = m_state.ways().find(w.first);
+        if (old == m_state.ways().end() && !member_ways.get(w.first)) {
+            continue;
+        }
+        m_affected.insert(w.first);
+        if (!way.visible()) {
+            if (old != m_state.ways().end()) {
+                m_state.ways().erase(old);
+            }
+            continue;
+        }
+
+        const uint8_t flags = m_rules.way_flags(way.tags());
+        BorderState::way &state = m_state.ways()[w.first];
+        state.disputed = flags & TagRules::flag_disputed;
+        state.maritime = flags & TagRules::flag_maritime;
+        state.nodes.clear();
+        for (const auto &nr : way.nodes()) {
+            state.nodes.push_back(nr.ref());
+            if (m_state.get_location(nr.ref()).valid()) {
+                continue;
+            }
+            const auto n = nodes.find(nr.ref());
+            if (n != nodes.end() && n->second->visible()) {
+                m_state.add_node(nr.ref(), n->second->location());
+            } else {
+                std::cerr << "Warning: location of node " << nr.ref()
+                          << " in way " << w.first
+                          << " is not known, a full run is needed.\n";
+                ++m_warnings;
+            }
+        }
+    }
+
+    for (const auto &w : m_state.ways()) {
+        for (const auto id : w.second.nodes) {
+            if (moved_nodes.get(id)) {
+                m_affected.insert(w.first);
+                break;
+            }
+        }
+    }
+
+    // Ways that left all relations were affected by the relation change
+    // and aren't needed any more
+    for (auto it = m_state.ways().begin(); it != m_state.ways().end();) {
+        if (member_ways.get(it->first)) {
+            ++it;
+        } else {
+            it = m_state.ways().erase(it);
+        }
+    }
+    for (const auto id : m_affected) {
+        if (member_ways.get(id) && !m_state.ways().count(id)) {
+            std::cerr << "Warning: way " << id
+                      << " is not known, a full run is needed.\n";
+            ++m_warnings;
+        }
+    }
+
+    m_state.remove_unused_nodes();
+}
+
+void StateUpdater::write_lines(LineWriter &writer,
+                               GeometryErrors &errors) const
+{
+    WayLevelsTable way_levels;
+    for (const auto &r : m_state.relations()) {
+        for (const auto id : r.second.ways) {
+            if (r.second.admin_level >= 0) {
+                way_levels.add(id, r.second.admin_level);
+            }
+            if (r.second.flags) {
+                way_levels.add_flags(id, r.second.flags);
+            }
+        }
+    }
+    way_levels.prepare();
+
+    std::vector<BorderLine> lines;
+    for (const auto id : m_affected) {
+        const auto way = m_state.ways().find(id);
+        const WayLevels *levels = way_levels.get(id);
+        if (way == m_state.ways().end() || levels == nullptr ||
+            levels->empty()) {
+            continue;
+        }
+
+        BorderLine line;
+        line.id = id;
+        line.admin_level = levels->min_level();
+        line.dividing_line = levels->dividing_line();
+        line.disputed = way->second.disputed ||
+                        (levels->flags & TagRules::flag_disputed);
+        line.maritime = way->second.maritime ||
+                        (levels->flags & TagRules::flag_maritime);
+        try {
+            set_coordinates(line, way->second.nodes.begin(),
+                            way->second.nodes.end(),
+                            [this](osmium::object_id_type node_id) {
+                                return m_state.get_location(node_id);
+                            });
+            lines.push_back(std::move(line));
+        } catch (osmium::geometry_error &e) {
+            ++errors.too_few_points;
+            std::cerr << "Geometry error on way " << id << ": " << e.what()
+                      << "\n";
+        } catch (osmium::invalid_location &e) {
+            ++errors.missing_location;
+            std::cerr << "Geometry error on way " << id
+                      << ": invalid location\n";
+        }
+    }
+    writer.write(std::make_shared<const std::vector<BorderLine>>(
+        std::move(lines)));
+}
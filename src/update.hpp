@@ -0,0 +1,84 @@
+#ifndef UPDATE_HPP
+#define UPDATE_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/osm/types.hpp>
+
+#include "linewriter.hpp"
+#include "state.hpp"
+#include "stats.hpp"
+#include "tagrules.hpp"
+
+/**
+ * Applies an OSM change file to the state saved by an earlier run and finds
+ * the border ways whose output rows changed.
+ *
+ * A way is affected if its tags or nodes changed, if a relation it belongs
+ * to changed, or if one of its nodes moved. Ways that stop being border
+ * ways are affected too, so their old rows can be removed.
+ *
+ * Only objects already in the state or in the change file are known. If a
+ * relation gains a way that is in neither, or a way gains a node that is in
+ * neither, this is counted as a warning and a full run is needed to pick
+ * them up.
+ */
+class StateUpdater
+{
+public:
+    StateUpdater(BorderState &state, const TagRules &rules)
+    : m_state(state), m_rules(rules)
+    {
+    }
+
+    /// Read a change file and apply it to the state.
+    void apply(const osmium::io::File &change_file);
+
+    /// IDs of the ways whose rows must be replaced, in ascending order
+    const std::set<osmium::object_id_type> &affected_ways() const
+    {
+        return m_affected;
+    }
+
+    /**
+     * Write the current lines of all affected ways that are still border
+     * ways. Geometry errors are reported on std::cerr and counted in
+     * errors, the same as in a full run.
+     */
+    void write_lines(LineWriter &writer, GeometryErrors &errors) const;
+
+    unsigned int warnings() const { return m_warnings; }
+
+private:
+    BorderState &m_state;
+    const TagRules &m_rules;
+    std::vector<osmium::memory::Buffer> m_buffers;
+    std::set<osmium::object_id_type> m_affected;
+    unsigned int m_warnings = 0;
+};
+
+#endif // UPDATE_HPP
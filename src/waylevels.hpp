@@ -0,0 +1,161 @@
+#ifndef WAYLEVELS_HPP
+#define WAYLEVELS_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <osmium/osm/types.hpp>
+
+/**
+ * Summary of the admin levels of the parent relations of one way. Bit n of
+ * levels is set if at least one parent has admin_level n, bit n of
+ * duplicates if two or more do. flags are the TagRules flags any parent
+ * relation passes on to its ways.
+ */
+struct WayLevels
+{
+    static constexpr int max_level = 15;
+
+    uint16_t levels = 0;
+    uint16_t duplicates = 0;
+    uint8_t flags = 0;
+
+    void add(int level)
+    {
+        const uint16_t bit = static_cast<uint16_t>(1u << level);
+        duplicates |= levels & bit;
+        levels |= bit;
+    }
+
+    void merge(const WayLevels &other)
+    {
+        duplicates |= other.duplicates | (levels & other.levels);
+        levels |= other.levels;
+        flags |= other.flags;
+    }
+
+    bool empty() const { return levels == 0; }
+
+    /// Lowest admin level of the parents. Only valid if not empty().
+    int min_level() const
+    {
+        int level = 0;
+        while (!(levels & (1u << level))) {
+            ++level;
+        }
+        return level;
+    }
+
+    /// Do two parents have the same admin level?
+    bool dividing_line() const { return duplicates != 0; }
+};
+
+/**
+ * Flat table mapping way IDs to their WayLevels. Entries are appended while
+ * reading relations, then prepare() sorts and folds them so lookups are a
+ * binary search over a contiguous array.
+ */
+class WayLevelsTable
+{
+    struct entry
+    {
+        osmium::object_id_type id;
+        WayLevels levels;
+
+        bool operator<(const entry &other) const { return id < other.id; }
+    };
+
+    std::vector<entry> m_entries;
+
+public:
+    void add(osmium::object_id_type way_id, int level)
+    {
+        entry e;
+        e.id = way_id;
+        e.levels.add(level);
+        m_entries.push_back(e);
+    }
+
+    /**
+     * Add flags from a parent relation. They only show up in the output if
+     * the way also has a parent with an admin level.
+     */
+    void add_flags(osmium::object_id_type way_id, uint8_t flags)
+    {
+        entry e;
+        e.id = way_id;
+        e.levels.flags = flags;
+        m_entries.push_back(e);
+    }
+
+    /**
+     * Sort the entries and merge those for the same way. Must be called
+     * after the last add() and before any get().
+     */
+    void prepare()
+    {
+        std::stable_sort(m_entries.begin(), m_entries.end());
+        auto out = m_entries.begin();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (out != m_entries.begin() && (out - 1)->id == it->id) {
+                (out - 1)->levels.merge(it->levels);
+            } else {
+                *out++ = *it;
+            }
+        }
+        m_entries.erase(out, m_entries.end());
+        m_entries.shrink_to_fit();
+    }
+
+    /// Returns the levels for a way, or nullptr if it's not in any relation.
+    const WayLevels *get(osmium::object_id_type way_id) const
+    {
+        entry e;
+        e.id = way_id;
+        const auto it =
+            std::lower_bound(m_entries.begin(), m_entries.end(), e);
+        if (it == m_entries.end() || it->id != way_id) {
+            return nullptr;
+        }
+        return &it->levels;
+    }
+
+    /// IDs of the ways with at least one admin level, in ascending order.
+    std::vector<osmium::object_id_type> ids() const
+    {
+        std::vector<osmium::object_id_type> result;
+        for (const auto &e : m_entries) {
+            if (!e.levels.empty()) {
+                result.push_back(e.id);
+            }
+        }
+        return result;
+    }
+
+    size_t size() const { return m_entries.size(); }
+
+    size_t used_memory() const { return m_entries.capacity() * sizeof(entry); }
+};
+
+#endif // WAYLEVELS_HPP
@@ -0,0 +1,76 @@
+#ifndef WKB_HPP
+#define WKB_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <osmium/geom/coordinates.hpp>
+
+namespace wkb {
+
+// EWKB flag marking that an SRID follows the geometry type
+const uint32_t srid_flag = 0x20000000;
+const uint32_t linestring_type = 2;
+const uint32_t web_mercator_srid = 3857;
+
+inline void append_uint32(std::string &out, uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8) {
+        out += static_cast<char>(value >> shift);
+    }
+}
+
+inline void append_double(std::string &out, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int shift = 0; shift < 64; shift += 8) {
+        out += static_cast<char>(bits >> shift);
+    }
+}
+
+/**
+ * Append a little endian EWKB linestring with the given SRID. These are the
+ * same bytes libosmium's WKBFactory creates with wkb_type::ewkb.
+ */
+inline void
+append_ewkb_linestring(std::string &out,
+                       const std::vector<osmium::geom::Coordinates> &coords,
+                       uint32_t srid = web_mercator_srid)
+{
+    out.reserve(out.size() + 13 + 16 * coords.size());
+    out += '\1';
+    append_uint32(out, linestring_type | srid_flag);
+    append_uint32(out, srid);
+    append_uint32(out, static_cast<uint32_t>(coords.size()));
+    for (const auto &c : coords) {
+        append_double(out, c.x);
+        append_double(out, c.y);
+    }
+}
+
+} // namespace wkb
+
+#endif // WKB_HPP
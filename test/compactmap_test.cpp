@@ -0,0 +1,197 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include <osmium/index/index.hpp>
+#include <osmium/index/map.hpp>
+
+#ifdef _MSC_VER
+#define fileno _fileno
+#endif
+
+#include "compactmap.hpp"
+#include "test.hpp"
+
+namespace {
+
+typedef std::map<osmium::unsigned_object_id_type, osmium::Location>
+    reference_map;
+
+void check_lookups(const CompactLocationMap &map, const reference_map &ref)
+{
+    CHECK(map.size() == ref.size());
+    for (const auto &e : ref) {
+        CHECK(map.get(e.first) == e.second);
+        CHECK(map.get_noexcept(e.first) == e.second);
+    }
+}
+
+/// Write the map with dump_as_list() and compare what is read back.
+void check_dump(CompactLocationMap &map, const reference_map &ref)
+{
+    FILE *file = std::tmpfile();
+    CHECK(file != nullptr);
+    if (!file) {
+        return;
+    }
+    map.dump_as_list(fileno(file));
+    std::rewind(file);
+
+    std::pair<osmium::unsigned_object_id_type, osmium::Location> entry;
+    auto expected = ref.begin();
+    size_t count = 0;
+    while (std::fread(&entry, sizeof(entry), 1, file) == 1) {
+        CHECK(expected != ref.end());
+        if (expected == ref.end()) {
+            break;
+        }
+        CHECK(entry.first == expected->first);
+        CHECK(entry.second == expected->second);
+        ++expected;
+        ++count;
+    }
+    CHECK(count == ref.size());
+    std::fclose(file);
+}
+
+void test_in_order()
+{
+    CompactLocationMap map;
+    reference_map ref;
+    osmium::unsigned_object_id_type id = 1;
+    int32_t x = 100000000;
+    int32_t y = -50000000;
+    for (int i = 0; i < 10000; ++i) {
+        // Runs of consecutive IDs with gaps, and a jump now and then
+        id += (i % 7 == 0) ? 1 + static_cast<unsigned>(i % 300) : 1;
+        x += (i * 37) % 2001 - 1000;
+        y -= (i * 53) % 4001 - 2000;
+        if (i % 1000 == 999) {
+            x = -x;
+        }
+        map.set(id, osmium::Location{x, y});
+        ref[id] = osmium::Location{x, y};
+    }
+    map.sort();
+    check_lookups(map, ref);
+
+    // IDs between and after the ones set
+    CHECK(!map.get_noexcept(0).valid());
+    CHECK(!map.get_noexcept(id + 1).valid());
+    bool thrown = false;
+    try {
+        map.get(id + 1000);
+    } catch (const osmium::not_found &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    check_dump(map, ref);
+}
+
+void test_out_of_order()
+{
+    CompactLocationMap map;
+    reference_map ref;
+    for (osmium::unsigned_object_id_type id = 1000; id < 2000; id += 3) {
+        const osmium::Location location{static_cast<int32_t>(id), 7};
+        map.set(id, location);
+        ref[id] = location;
+    }
+    // Before, between and among the ones already set
+    for (osmium::unsigned_object_id_type id = 1; id < 3000; id += 101) {
+        if (ref.count(id)) {
+            continue;
+        }
+        const osmium::Location location{-static_cast<int32_t>(id), 9};
+        map.set(id, location);
+        ref[id] = location;
+    }
+    map.sort();
+    check_lookups(map, ref);
+    CHECK(!map.get_noexcept(1001).valid());
+    check_dump(map, ref);
+}
+
+void test_duplicates()
+{
+    CompactLocationMap map;
+    reference_map ref;
+    for (osmium::unsigned_object_id_type id = 1; id <= 500; ++id) {
+        const osmium::Location location{static_cast<int32_t>(id), 1};
+        map.set(id, location);
+        ref[id] = location;
+    }
+    // Set again once they are packed, some of them twice. The later
+    // location wins, as in the other indexes.
+    for (osmium::unsigned_object_id_type id = 10; id <= 500; id += 10) {
+        map.set(id, osmium::Location{static_cast<int32_t>(id), 2});
+        const osmium::Location location{static_cast<int32_t>(id), 3};
+        if (id % 20 == 0) {
+            map.set(id, location);
+            ref[id] = location;
+        } else {
+            ref[id] = osmium::Location{static_cast<int32_t>(id), 2};
+        }
+    }
+    // The last ID set twice in a row, while still pending
+    map.set(501, osmium::Location{501, 1});
+    map.set(501, osmium::Location{501, 4});
+    ref[501] = osmium::Location{501, 4};
+
+    map.sort();
+    check_lookups(map, ref);
+    // Sorting again changes nothing
+    map.sort();
+    check_lookups(map, ref);
+    check_dump(map, ref);
+}
+
+void test_clear()
+{
+    CompactLocationMap map;
+    map.set(5, osmium::Location{1, 2});
+    map.sort();
+    map.clear();
+    CHECK(map.size() == 0);
+    map.set(3, osmium::Location{3, 4});
+    map.sort();
+    CHECK(map.size() == 1);
+    CHECK(map.get(3) == (osmium::Location{3, 4}));
+    CHECK(!map.get_noexcept(5).valid());
+}
+
+} // anonymous namespace
+
+int main()
+{
+    test_in_order();
+    test_out_of_order();
+    test_duplicates();
+    test_clear();
+    return test::result();
+}
@@ -0,0 +1,259 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "borderline.hpp"
+#include "flatgeobuf.hpp"
+#include "output.hpp"
+#include "test.hpp"
+
+namespace {
+
+/// Just enough of a FlatBuffers reader to follow the osmborder schema
+class fb_reader
+{
+    const std::string &m_buf;
+
+public:
+    explicit fb_reader(const std::string &buf) : m_buf(buf) {}
+
+    uint64_t uint(size_t pos, size_t size) const
+    {
+        uint64_t value = 0;
+        for (size_t i = size; i > 0; --i) {
+            value = (value << 8) |
+                    static_cast<unsigned char>(m_buf.at(pos + i - 1));
+        }
+        return value;
+    }
+
+    double real(size_t pos) const
+    {
+        const uint64_t bits = uint(pos, 8);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    /// Position of the root table of the size prefixed buffer at pos
+    size_t root(size_t pos) const { return pos + 4 + uint(pos + 4, 4); }
+
+    /// Position of a field of the table at pos, 0 if it isn't set
+    size_t field(size_t table, uint16_t id) const
+    {
+        const size_t vtable = table - static_cast<int32_t>(uint(table, 4));
+        const uint64_t vtable_size = uint(vtable, 2);
+        if (4 + 2 * uint64_t(id) >= vtable_size) {
+            return 0;
+        }
+        const uint64_t offset = uint(vtable + 4 + 2 * id, 2);
+        return offset ? table + offset : 0;
+    }
+
+    /// Follow the offset to a table, vector or string
+    size_t deref(size_t pos) const { return pos + uint(pos, 4); }
+};
+
+struct decoded
+{
+    BorderLine line;
+    std::string way_ids;
+};
+
+/// Decode the size prefixed Feature at pos.
+decoded decode_feature(const std::string &buf, size_t pos)
+{
+    const fb_reader fb(buf);
+    const size_t feature = fb.root(pos);
+    decoded d;
+
+    const size_t geometry = fb.deref(fb.field(feature, 0));
+    const size_t xy = fb.deref(fb.field(geometry, 1));
+    const uint64_t count = fb.uint(xy, 4);
+    for (uint64_t i = 0; i < count; i += 2) {
+        d.line.coordinates.emplace_back(fb.real(xy + 4 + 8 * i),
+                                        fb.real(xy + 12 + 8 * i));
+    }
+
+    const size_t properties = fb.deref(fb.field(feature, 1));
+    const size_t end = properties + 4 + fb.uint(properties, 4);
+    for (size_t p = properties + 4; p < end;) {
+        const uint64_t column = fb.uint(p, 2);
+        p += 2;
+        switch (column) {
+        case 0:
+            d.line.id = static_cast<int64_t>(fb.uint(p, 8));
+            p += 8;
+            break;
+        case 1:
+            d.line.admin_level = static_cast<int32_t>(fb.uint(p, 4));
+            p += 4;
+            break;
+        case 2:
+            d.line.dividing_line = fb.uint(p++, 1) != 0;
+            break;
+        case 3:
+            d.line.disputed = fb.uint(p++, 1) != 0;
+            break;
+        case 4:
+            d.line.maritime = fb.uint(p++, 1) != 0;
+            break;
+        case 5: {
+            const uint64_t size = fb.uint(p, 4);
+            d.way_ids = buf.substr(p + 4, size);
+            p += 4 + size;
+            break;
+        }
+        default:
+            CHECK(false);
+            p = end;
+        }
+    }
+    return d;
+}
+
+std::vector<BorderLine> test_lines()
+{
+    std::vector<BorderLine> lines(3);
+    lines[0].id = 123456789012LL;
+    lines[0].admin_level = 2;
+    lines[0].dividing_line = true;
+    lines[0].maritime = true;
+    lines[0].coordinates = {{-20037508.342789244, 1.5}, {0.0, -0.25},
+                            {12345.678, 1e7}};
+    lines[1].id = -42;
+    lines[1].admin_level = 11;
+    lines[1].disputed = true;
+    lines[1].coordinates = {{1.0, 2.0}, {3.0, 4.0}};
+    lines[2].id = 7;
+    lines[2].admin_level = 4;
+    lines[2].coordinates = {{5e6, 5e6}, {5e6 + 1, 5e6 - 1}};
+    lines[2].way_ids = {7, -8, 9};
+    return lines;
+}
+
+void check_line(const decoded &d, const BorderLine &line)
+{
+    CHECK(d.line.id == line.id);
+    CHECK(d.line.admin_level == line.admin_level);
+    CHECK(d.line.dividing_line == line.dividing_line);
+    CHECK(d.line.disputed == line.disputed);
+    CHECK(d.line.maritime == line.maritime);
+    CHECK(d.line.coordinates.size() == line.coordinates.size());
+    for (size_t i = 0; i < line.coordinates.size() &&
+                       i < d.line.coordinates.size();
+         ++i) {
+        CHECK(d.line.coordinates[i].x == line.coordinates[i].x);
+        CHECK(d.line.coordinates[i].y == line.coordinates[i].y);
+    }
+    std::string way_ids;
+    for (const auto id : line.way_ids) {
+        if (!way_ids.empty()) {
+            way_ids += ',';
+        }
+        way_ids += std::to_string(id);
+    }
+    CHECK(d.way_ids == way_ids);
+}
+
+void test_features()
+{
+    for (const auto &line : test_lines()) {
+        const flatgeobuf::feature f = flatgeobuf::encode_feature(line);
+        const fb_reader fb(f.data);
+        CHECK(fb.uint(0, 4) + 4 == f.data.size());
+        check_line(decode_feature(f.data, 0), line);
+        CHECK(f.min_x <= f.max_x);
+        CHECK(f.min_y <= f.max_y);
+    }
+}
+
+void test_file()
+{
+    const std::vector<BorderLine> lines = test_lines();
+    const std::string filename = "flatgeobuf_test.fgb";
+    {
+        std::vector<flatgeobuf::feature> features;
+        for (const auto &line : lines) {
+            features.push_back(flatgeobuf::encode_feature(line));
+        }
+        OutputWriter out(filename, 1);
+        flatgeobuf::write_file(out, features, true);
+        out.close();
+    }
+    std::ifstream in(filename, std::ios::binary);
+    const std::string buf{std::istreambuf_iterator<char>(in),
+                          std::istreambuf_iterator<char>()};
+    in.close();
+    std::remove(filename.c_str());
+
+    CHECK(buf.compare(0, 8, std::string("fgb\3fgb\0", 8)) == 0);
+    const fb_reader fb(buf);
+    const size_t header = fb.root(8);
+    const size_t count_field = fb.field(header, 8);
+    CHECK(count_field != 0);
+    CHECK(fb.uint(count_field, 8) == lines.size());
+    const size_t node_size_field = fb.field(header, 9);
+    CHECK(node_size_field != 0);
+    const uint64_t node_size = fb.uint(node_size_field, 2);
+    CHECK(node_size == 16);
+    const size_t columns = fb.deref(fb.field(header, 7));
+    CHECK(fb.uint(columns, 4) == 6);
+
+    // The index, then the features in Hilbert order
+    uint64_t num_nodes = 0;
+    for (uint64_t n = lines.size(); num_nodes += n, n > 1;) {
+        n = (n + node_size - 1) / node_size;
+    }
+    size_t pos = 12 + fb.uint(8, 4) + 40 * num_nodes;
+    std::map<int64_t, decoded> features;
+    while (pos < buf.size()) {
+        const decoded d = decode_feature(buf, pos);
+        features[d.line.id] = d;
+        pos += 4 + fb.uint(pos, 4);
+    }
+    CHECK(pos == buf.size());
+    CHECK(features.size() == lines.size());
+    for (const auto &line : lines) {
+        CHECK(features.count(line.id) == 1);
+        if (features.count(line.id)) {
+            check_line(features[line.id], line);
+        }
+    }
+}
+
+} // anonymous namespace
+
+int main()
+{
+    test_features();
+    test_file();
+    return test::result();
+}
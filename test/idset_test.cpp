@@ -0,0 +1,124 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <cstdint>
+#include <set>
+
+#include <osmium/osm/types.hpp>
+
+#include "idset.hpp"
+#include "test.hpp"
+
+namespace {
+
+/// Check get() for every ID from first to last against ref.
+void check_range(const IdSet &ids, const std::set<osmium::object_id_type> &ref,
+                 osmium::object_id_type first, osmium::object_id_type last)
+{
+    for (osmium::object_id_type id = first; id <= last; ++id) {
+        CHECK(ids.get(id) == (ref.count(id) > 0));
+    }
+}
+
+void test_negative()
+{
+    IdSet ids;
+    std::set<osmium::object_id_type> ref;
+    for (const osmium::object_id_type id : {-1, -2, -65536, -65537, -1000000,
+                                            0, 1, 65536, 1000000}) {
+        ids.set(id);
+        ref.insert(id);
+    }
+    // Setting again changes nothing
+    ids.set(-1);
+    ids.set(1);
+    CHECK(ids.size() == ref.size());
+
+    check_range(ids, ref, -70000, 70000);
+    CHECK(ids.get(-1000000));
+    CHECK(!ids.get(-999999));
+    CHECK(!ids.get(-1000001));
+
+    CHECK(ids.any_in(-3, -2));
+    CHECK(!ids.any_in(-65535, -3));
+    CHECK(ids.any_in(-65536, -65536));
+    CHECK(!ids.any_in(-999999, -65538));
+    // Ranges across zero
+    CHECK(ids.any_in(-1, 0));
+    CHECK(!ids.any_in(2, -2));
+    IdSet positive;
+    positive.set(5);
+    CHECK(positive.any_in(-10, 10));
+    CHECK(!positive.any_in(-10, 4));
+    IdSet negative;
+    negative.set(-5);
+    CHECK(negative.any_in(-10, 10));
+    CHECK(!negative.any_in(-4, 10));
+    CHECK(!negative.get(5));
+}
+
+void test_bitmap_chunks()
+{
+    // Enough IDs in one chunk to turn it into a bitmap, on both sides
+    IdSet ids;
+    std::set<osmium::object_id_type> ref;
+    for (osmium::object_id_type id = 3; id < 65536; id += 7) {
+        ids.set(id);
+        ids.set(-id);
+        ref.insert(id);
+        ref.insert(-id);
+    }
+    CHECK(ids.size() == ref.size());
+    check_range(ids, ref, -70000, 70000);
+    CHECK(ids.any_in(-10, -10));
+    CHECK(!ids.any_in(-9, -4));
+    CHECK(!ids.any_in(4, 9));
+}
+
+void test_huge_ids()
+{
+    // Beyond the directly indexed chunks
+    const osmium::object_id_type huge = osmium::object_id_type(1) << 50;
+    IdSet ids;
+    ids.set(huge);
+    ids.set(-huge);
+    ids.set(-huge - 1);
+    CHECK(ids.size() == 3);
+    CHECK(ids.get(huge));
+    CHECK(ids.get(-huge));
+    CHECK(ids.get(-huge - 1));
+    CHECK(!ids.get(huge + 1));
+    CHECK(!ids.get(-huge + 1));
+    CHECK(ids.any_in(-huge, -huge));
+    CHECK(ids.any_in(-huge - 5, -huge + 5));
+    CHECK(!ids.any_in(-huge + 1, huge - 1));
+}
+
+} // anonymous namespace
+
+int main()
+{
+    test_negative();
+    test_bitmap_chunks();
+    test_huge_ids();
+    return test::result();
+}
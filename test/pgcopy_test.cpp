@@ -0,0 +1,214 @@
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <osmium/geom/coordinates.hpp>
+
+#include "pgcopy.hpp"
+#include "test.hpp"
+#include "wkb.hpp"
+
+namespace {
+
+/// Reads back what the pgcopy functions write, in network byte order.
+class reader
+{
+    const std::string &m_data;
+    size_t m_pos = 0;
+
+public:
+    explicit reader(const std::string &data) : m_data(data) {}
+
+    bool at_end() const { return m_pos == m_data.size(); }
+
+    uint64_t uint(size_t size)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size && m_pos < m_data.size(); ++i) {
+            value = (value << 8) | static_cast<unsigned char>(m_data[m_pos++]);
+        }
+        return value;
+    }
+
+    int16_t int16() { return static_cast<int16_t>(uint(2)); }
+    int32_t int32() { return static_cast<int32_t>(uint(4)); }
+    int64_t int64() { return static_cast<int64_t>(uint(8)); }
+
+    std::string bytes(size_t size)
+    {
+        const std::string value = m_data.substr(m_pos, size);
+        m_pos += value.size();
+        return value;
+    }
+
+    int64_t bigint_field()
+    {
+        CHECK(int32() == 8);
+        return int64();
+    }
+
+    int32_t int_field()
+    {
+        CHECK(int32() == 4);
+        return int32();
+    }
+
+    bool bool_field()
+    {
+        CHECK(int32() == 1);
+        return uint(1) != 0;
+    }
+
+    std::vector<int64_t> bigint_array_field()
+    {
+        const int32_t size = int32();
+        CHECK(int32() == 1); // dimensions
+        CHECK(int32() == 0); // no NULLs
+        CHECK(int32() == 20); // bigint
+        const int32_t count = int32();
+        CHECK(size == 20 + 12 * count);
+        CHECK(int32() == 1); // lower bound
+        std::vector<int64_t> values;
+        for (int32_t i = 0; i < count; ++i) {
+            values.push_back(bigint_field());
+        }
+        return values;
+    }
+};
+
+/// Little endian EWKB linestring back to coordinates
+std::vector<osmium::geom::Coordinates> read_ewkb(const std::string &data)
+{
+    const auto le = [&data](size_t pos, size_t size) {
+        uint64_t value = 0;
+        for (size_t i = size; i > 0; --i) {
+            value = (value << 8) |
+                    static_cast<unsigned char>(data.at(pos + i - 1));
+        }
+        return value;
+    };
+    std::vector<osmium::geom::Coordinates> coordinates;
+    CHECK(data.at(0) == '\1');
+    CHECK(le(1, 4) == (wkb::linestring_type | wkb::srid_flag));
+    CHECK(le(5, 4) == wkb::web_mercator_srid);
+    const uint64_t count = le(9, 4);
+    CHECK(data.size() == 13 + 16 * count);
+    for (uint64_t i = 0; i < count; ++i) {
+        const uint64_t x = le(13 + 16 * i, 8);
+        const uint64_t y = le(21 + 16 * i, 8);
+        osmium::geom::Coordinates c;
+        std::memcpy(&c.x, &x, sizeof(x));
+        std::memcpy(&c.y, &y, sizeof(y));
+        coordinates.push_back(c);
+    }
+    return coordinates;
+}
+
+struct row
+{
+    int64_t id;
+    int32_t admin_level;
+    bool dividing_line;
+    bool disputed;
+    bool maritime;
+    std::vector<osmium::geom::Coordinates> coordinates;
+    std::vector<int64_t> way_ids;
+};
+
+void append_row(std::string &out, const row &r, bool way_ids)
+{
+    std::string ewkb;
+    wkb::append_ewkb_linestring(ewkb, r.coordinates);
+    pgcopy::append_tuple(out, way_ids ? 7 : 6);
+    pgcopy::append_bigint_field(out, r.id);
+    pgcopy::append_int_field(out, r.admin_level);
+    pgcopy::append_bool_field(out, r.dividing_line);
+    pgcopy::append_bool_field(out, r.disputed);
+    pgcopy::append_bool_field(out, r.maritime);
+    pgcopy::append_bytes_field(out, ewkb);
+    if (way_ids) {
+        pgcopy::append_bigint_array_field(out, r.way_ids);
+    }
+}
+
+bool same_coordinates(const std::vector<osmium::geom::Coordinates> &a,
+                      const std::vector<osmium::geom::Coordinates> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].x != b[i].x || a[i].y != b[i].y) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void test_round_trip(bool way_ids)
+{
+    const std::vector<row> rows = {
+        {123456789012LL, 2, true, false, true,
+         {{-20037508.342789244, 1.5}, {0.0, -0.25}, {12345.678, 1e7}},
+         {123456789012LL, -5, 0}},
+        {-42, 11, false, true, false, {{1.0, 2.0}, {3.0, 4.0}}, {}}};
+
+    std::string data;
+    pgcopy::append_header(data);
+    for (const auto &r : rows) {
+        append_row(data, r, way_ids);
+    }
+    pgcopy::append_trailer(data);
+
+    reader in(data);
+    CHECK(in.bytes(11) == std::string("PGCOPY\n\377\r\n\0", 11));
+    CHECK(in.int32() == 0); // flags
+    CHECK(in.int32() == 0); // header extension
+    for (const auto &r : rows) {
+        CHECK(in.int16() == (way_ids ? 7 : 6));
+        CHECK(in.bigint_field() == r.id);
+        CHECK(in.int_field() == r.admin_level);
+        CHECK(in.bool_field() == r.dividing_line);
+        CHECK(in.bool_field() == r.disputed);
+        CHECK(in.bool_field() == r.maritime);
+        const int32_t size = in.int32();
+        CHECK(same_coordinates(read_ewkb(in.bytes(size)), r.coordinates));
+        if (way_ids) {
+            CHECK(in.bigint_array_field() == r.way_ids);
+        }
+    }
+    CHECK(in.int16() == -1);
+    CHECK(in.at_end());
+}
+
+} // anonymous namespace
+
+int main()
+{
+    test_round_trip(false);
+    test_round_trip(true);
+    return test::result();
+}
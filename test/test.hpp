@@ -0,0 +1,63 @@
+#ifndef TEST_HPP
+#define TEST_HPP
+/*
+
+  Copyright 2016 Paul Norman <penorman@mac.com>.
+
+  This file is part of OSMBorder.
+
+  OSMBorder is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OSMBorder is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OSMBorder.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <iostream>
+
+/**
+ * Minimal checks for the tests, which are plain programs run by ctest. A
+ * failed check is reported with its location, and result() makes the
+ * program exit with 1 if any failed.
+ */
+namespace test {
+
+inline int &failures()
+{
+    static int count = 0;
+    return count;
+}
+
+inline void check(bool ok, const char *expression, const char *file,
+                  int line)
+{
+    if (!ok) {
+        std::cerr << file << ':' << line << ": check failed: " << expression
+                  << '\n';
+        ++failures();
+    }
+}
+
+inline int result()
+{
+    if (failures() > 0) {
+        std::cerr << failures() << " checks failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace test
+
+#define CHECK(expression)                                                      \
+    test::check((expression), #expression, __FILE__, __LINE__)
+
+#endif // TEST_HPP